@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "car.cpp"
+
+const int NUM_MOVE_STATES = MOVE_STRAIGHT_DOWN + 1;
+
+// The cars waiting to get into a sync region in one direction, as an
+// AdmissionPolicy sees them. `ticket` and `overtaken` are of the car at the
+// front; `overtaken` is how many cars were let in since it asked.
+struct WaitingQueue {
+    size_t size = 0;
+    uint64_t ticket = 0;
+    uint64_t overtaken = 0;
+};
+
+struct RegionState {
+    WaitingQueue queues[NUM_MOVE_STATES];
+    int holders = 0;
+    // direction of the cars inside, while holders > 0
+    CarMoveState holderState = MOVE_RIGHT;
+};
+
+// Decides which waiting car a SyncSystem lets in next. Called with the
+// region's mutex held whenever there's a free token and someone waiting,
+// over and over until it says nobody. Whatever it answers, a car never gets
+// in while cars going another way are inside.
+//
+// Policies only look at tickets and counts, never at the time, so a headless
+// run still does the same thing every time.
+class AdmissionPolicy {
+public:
+    virtual ~AdmissionPolicy() = default;
+
+    // Direction of the queue to let the front car of in, or nullopt to let
+    // nobody in for now.
+    virtual std::optional<CarMoveState> next(const RegionState& region) = 0;
+
+    // Told about every car let in.
+    virtual void granted(CarMoveState) {}
+
+    virtual const char* name() const = 0;
+};
+
+// Cars get in in the order they asked, and never overtake a waiting car
+// going another way. Under mixed traffic the region switches direction
+// almost every car.
+class FifoPolicy: public AdmissionPolicy {
+public:
+    std::optional<CarMoveState> next(const RegionState& region) override {
+        std::optional<CarMoveState> oldest;
+        for(int state = 0; state < NUM_MOVE_STATES; ++state) {
+            const WaitingQueue& queue = region.queues[state];
+            if(queue.size && (!oldest || queue.ticket < region.queues[*oldest].ticket)) {
+                oldest = CarMoveState(state);
+            }
+        }
+        if(oldest && region.holders > 0 && *oldest != region.holderState) {
+            return std::nullopt;
+        }
+        return oldest;
+    }
+
+    const char* name() const override {
+        return "fifo";
+    }
+};
+
+// Lets cars in in phases of one direction at a time. A phase starts on the
+// longest queue and lasts for as many cars as were in it, between MIN_PHASE
+// and MAX_PHASE, or for as long as nobody else waits. Then the region drains
+// and the next phase starts.
+//
+// A car is never passed by more than about MAX_OVERTAKEN others: once the
+// front of some other queue was, the phase ends and that queue goes next.
+class PhasePolicy: public AdmissionPolicy {
+public:
+    static const uint64_t MIN_PHASE = 4;
+    static const uint64_t MAX_PHASE = 32;
+    static const uint64_t MAX_OVERTAKEN = 64;
+
+    std::optional<CarMoveState> next(const RegionState& region) override {
+        std::optional<CarMoveState> starving;
+        bool othersWaiting = false;
+        for(int state = 0; state < NUM_MOVE_STATES; ++state) {
+            const WaitingQueue& queue = region.queues[state];
+            if(!queue.size || (phase && state == *phase)) {
+                continue;
+            }
+            othersWaiting = true;
+            if(queue.overtaken >= MAX_OVERTAKEN && (!starving || queue.ticket < region.queues[*starving].ticket)) {
+                starving = CarMoveState(state);
+            }
+        }
+
+        if(phase && region.queues[*phase].size && !starving && (inPhase < phaseLength || !othersWaiting)) {
+            return phase;
+        }
+        // the next phase waits until the cars of this one are through
+        if(region.holders > 0) {
+            return std::nullopt;
+        }
+
+        std::optional<CarMoveState> longest = starving;
+        for(int state = 0; state < NUM_MOVE_STATES && !starving; ++state) {
+            const WaitingQueue& queue = region.queues[state];
+            if(!queue.size) {
+                continue;
+            }
+            if(!longest || queue.size > region.queues[*longest].size
+                || (queue.size == region.queues[*longest].size && queue.ticket < region.queues[*longest].ticket)) {
+                longest = CarMoveState(state);
+            }
+        }
+        if(!longest) {
+            return std::nullopt;
+        }
+
+        phase = longest;
+        inPhase = 0;
+        phaseLength = std::clamp<uint64_t>(region.queues[*phase].size, MIN_PHASE, MAX_PHASE);
+        return phase;
+    }
+
+    void granted(CarMoveState) override {
+        ++inPhase;
+    }
+
+    const char* name() const override {
+        return "phase";
+    }
+
+private:
+    std::optional<CarMoveState> phase;
+    uint64_t inPhase = 0;
+    uint64_t phaseLength = 0;
+};
+
+// By name, as given on the command line. Returns nullptr for a name it
+// doesn't know.
+inline std::unique_ptr<AdmissionPolicy> makeAdmissionPolicy(const std::string& name) {
+    if(name == "fifo") {
+        return std::make_unique<FifoPolicy>();
+    }
+    if(name == "phase") {
+        return std::make_unique<PhasePolicy>();
+    }
+    return nullptr;
+}
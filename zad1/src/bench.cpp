@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "executor.cpp"
+#include "partition.cpp"
+#include "scenario.cpp"
+
+// Microbenchmarks for the hot paths. Every result is printed as one JSON
+// object per line, so runs from different builds can be diffed or loaded
+// into anything that reads JSON lines.
+//
+// usage: bench [max threads]
+
+const float MIN_BENCH_MS = 200.0f;
+
+// Runs `body` (which does `batch` operations) until at least MIN_BENCH_MS
+// passed, returns nanoseconds per operation.
+template <typename F>
+double timePerOp(uint64_t batch, F body) {
+    uint64_t ops = 0;
+    auto start = chrono::steady_clock::now();
+    float elapsed = 0.0f;
+    while(elapsed < MIN_BENCH_MS) {
+        body();
+        ops += batch;
+        elapsed = chrono::duration_cast<ms>(chrono::steady_clock::now() - start).count();
+    }
+    return elapsed * 1e6 / ops;
+}
+
+// The track without the crosstrack, so no sync regions in the way, to time
+// just the movement.
+RoadNetwork openRoad() {
+    RoadNetwork network = RoadNetwork::standard();
+    network.roads.clear();
+    network.build();
+    return network;
+}
+
+// Track cars spread all around the track.
+std::vector<Car> carsOnTrack(CarSystem& carSystem, size_t n) {
+    std::mt19937 gen(n);
+    std::uniform_int_distribution<int> car_offset_dist(-TRACK_THICKNESS / 4, TRACK_THICKNESS / 4);
+    std::uniform_real_distribution<float> speed_dist(CAR_SPEED_MIN, CAR_SPEED_MAX);
+    std::uniform_int_distribution<int> warmup_dist(0, 2 * (PATH_SIZE_X + PATH_SIZE_Y) / CAR_SPEED_MIN);
+
+    std::vector<Car> cars;
+    for(size_t i = 0; i < n; ++i) {
+        float x = car_offset_dist(gen);
+        float y = car_offset_dist(gen);
+        auto& car = cars.emplace_back(Car::spawnTrack({PATH_START_X, PATH_START_Y}, {x, y}, speed_dist(gen)));
+        for(int steps = warmup_dist(gen); steps > 0; --steps) {
+            carSystem.updateCar(car, false);
+        }
+    }
+    return cars;
+}
+
+void benchMovement() {
+    for(size_t n: {100, 1000, 10000, 100000}) {
+        CarSystem carSystem(openRoad());
+        std::vector<Car> cars = carsOnTrack(carSystem, n);
+        // the same work as updateCar, following is in the headless runs
+        CarStore store;
+        store.carFollowing = false;
+        for(auto& car: cars) {
+            store.add(car, carSystem);
+        }
+
+        double updateCarNs = timePerOp(n, [&] {
+            for(auto& car: cars) {
+                carSystem.updateCar(car, false);
+            }
+        });
+        double storeNs = timePerOp(n, [&] { store.step(carSystem); });
+
+        std::cout << "{\"bench\":\"updateCar\",\"cars\":" << n
+            << ",\"ns_per_car\":" << updateCarNs
+            << ",\"cars_per_s\":" << 1e9 / updateCarNs << "}\n";
+        std::cout << "{\"bench\":\"CarStore::step\",\"cars\":" << n
+            << ",\"ns_per_car\":" << storeNs
+            << ",\"cars_per_s\":" << 1e9 / storeNs << "}\n";
+    }
+}
+
+// Cars as coroutines, up to counts no thread per car run could start.
+void benchCoroutines() {
+    for(size_t n: {1000, 100000, 1000000}) {
+        CarSystem carSystem(openRoad());
+        CarExecutor executor(carSystem);
+        for(auto& car: carsOnTrack(carSystem, n)) {
+            executor.spawn(car);
+        }
+        executor.runTick();
+
+        double ns = timePerOp(n, [&] { executor.runTick(); });
+        std::cout << "{\"bench\":\"CarExecutor::runTick\",\"cars\":" << n
+            << ",\"ns_per_car\":" << ns
+            << ",\"cars_per_s\":" << 1e9 / ns << "}\n";
+    }
+}
+
+// Track cars spread over all the loops of `network`, driven around on a copy
+// without the roads so none of them holds a token.
+std::vector<Car> carsOnLoops(const RoadNetwork& network, size_t n) {
+    RoadNetwork loops = network;
+    loops.roads.clear();
+    loops.build();
+    CarSystem carSystem(loops);
+
+    std::mt19937 gen(n);
+    std::uniform_int_distribution<size_t> loop_dist(0, network.loops.size() - 1);
+    std::uniform_int_distribution<int> car_offset_dist(-network.thickness / 4, network.thickness / 4);
+    std::uniform_real_distribution<float> speed_dist(CAR_SPEED_MIN, CAR_SPEED_MAX);
+
+    std::vector<Car> cars;
+    for(size_t i = 0; i < n; ++i) {
+        uint16_t loop = loop_dist(gen);
+        const Rect& path = network.loops[loop].path;
+        float x = car_offset_dist(gen);
+        float y = car_offset_dist(gen);
+        auto& car = cars.emplace_back(Car::spawnTrack(network.loopStart(loop), {x, y}, speed_dist(gen), loop));
+        int steps = std::uniform_int_distribution<int>(0, 2 * (path.width + path.height) / CAR_SPEED_MIN)(gen);
+        for(; steps > 0; --steps) {
+            carSystem.updateCar(car, false);
+        }
+    }
+    return cars;
+}
+
+// Ticks per second of the partitioned engine with more and more strips.
+void benchPartitioned(const std::string& name, const RoadNetwork& network, size_t numCars, size_t maxWorkers) {
+    std::vector<Car> cars = carsOnLoops(network, numCars);
+    for(size_t workers = 1; workers <= maxWorkers; workers *= 2) {
+        CarSystem carSystem(network);
+        SimClock clock(false);
+        TripleBuffer<Snapshot> snapshots;
+        // without following and snapshots, only the stepping is measured
+        PartitionedEngine engine(carSystem, clock, snapshots, workers, false, false);
+        for(auto& car: cars) {
+            engine.add(car);
+        }
+
+        std::this_thread::sleep_for(chrono::milliseconds(100));
+        uint64_t startTick = engine.completed();
+        auto start = chrono::steady_clock::now();
+        std::this_thread::sleep_for(chrono::milliseconds(1000));
+        uint64_t ticks = engine.completed() - startTick;
+        float elapsed = chrono::duration_cast<ms>(chrono::steady_clock::now() - start).count();
+        size_t edges = engine.edgeIntersections();
+        carSystem.shutdown();
+        engine.stop();
+
+        std::cout << "{\"bench\":\"partitioned\",\"roads\":\"" << name << "\""
+            << ",\"cars\":" << numCars
+            << ",\"workers\":" << engine.numPartitions()
+            << ",\"edge_intersections\":" << edges
+            << ",\"ticks_per_s\":" << ticks / (elapsed / 1000.0f)
+            << ",\"cars_per_s\":" << ticks * numCars / (elapsed / 1000.0f) << "}\n";
+    }
+}
+
+// Every thread is one car going through the region over and over. With
+// `mixed` odd threads drive across the even ones, so the region keeps
+// switching direction.
+void benchTokens(int numThreads, bool mixed) {
+    const int ITERATIONS = 20000;
+    SyncSystem region;
+    std::vector<std::vector<uint32_t>> latencies(numThreads);
+
+    auto start = chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> threads;
+        for(int t = 0; t < numThreads; ++t) {
+            threads.emplace_back([&, t] {
+                Car car({0.0f, 0.0f}, 1.0f);
+                car.state = mixed && t % 2 ? MOVE_STRAIGHT_DOWN : MOVE_RIGHT;
+                auto& latency = latencies[t];
+                latency.reserve(ITERATIONS);
+                for(int i = 0; i < ITERATIONS; ++i) {
+                    auto requestStart = chrono::steady_clock::now();
+                    region.requestToken(car);
+                    auto granted = chrono::steady_clock::now();
+                    region.releaseToken(car);
+                    latency.push_back(chrono::duration_cast<chrono::nanoseconds>(granted - requestStart).count());
+                }
+            });
+        }
+    }
+    float elapsed = chrono::duration_cast<ms>(chrono::steady_clock::now() - start).count();
+
+    std::vector<uint32_t> all;
+    for(auto& latency: latencies) {
+        all.insert(all.end(), latency.begin(), latency.end());
+    }
+    std::sort(all.begin(), all.end());
+    auto percentile = [&](double p) { return all[std::min(all.size() - 1, size_t(p * all.size()))]; };
+
+    std::cout << "{\"bench\":\"requestToken/releaseToken\",\"threads\":" << numThreads
+        << ",\"mixed\":" << (mixed ? "true" : "false")
+        << ",\"ops_per_s\":" << all.size() / (elapsed / 1000.0f)
+        << ",\"request_p50_ns\":" << percentile(0.5)
+        << ",\"request_p99_ns\":" << percentile(0.99)
+        << ",\"request_max_ns\":" << all.back() << "}\n";
+}
+
+void benchScenario(const std::string& name, const RoadNetwork& network, int numTrackCars, uint64_t numTicks) {
+    Scenario scenario(network, numTrackCars, 0);
+    auto start = chrono::steady_clock::now();
+    for(uint64_t tick = 0; tick < numTicks; ++tick) {
+        scenario.step();
+    }
+    float elapsed = chrono::duration_cast<ms>(chrono::steady_clock::now() - start).count();
+
+    std::cout << "{\"bench\":\"headless\",\"roads\":\"" << name << "\""
+        << ",\"intersections\":" << network.intersections.size()
+        << ",\"track_cars\":" << numTrackCars
+        << ",\"ticks\":" << numTicks
+        << ",\"alive\":" << scenario.cars.size()
+        << ",\"ticks_per_s\":" << numTicks / (elapsed / 1000.0f) << "}\n";
+}
+
+// Cars per simulated second through the sync regions with each admission
+// policy, under traffic heavy enough to keep queues on both roads.
+void benchAdmission(const std::string& policy, uint64_t numTicks) {
+    RoadNetwork network = RoadNetwork::standard();
+    SpawnPlan plan;
+    plan.streams.push_back({false, 0, ARRIVAL_POISSON, 4.0, 1, 40});
+    plan.streams.push_back({true, 0, ARRIVAL_POISSON, 6.0});
+
+    Scenario scenario(network, plan, 0);
+    scenario.carSystem.setAdmissionPolicy(policy);
+    for(uint64_t tick = 0; tick < numTicks; ++tick) {
+        scenario.step();
+    }
+
+    float seconds = numTicks / float(SimClock::TICKS_PER_SECOND);
+    std::cout << "{\"bench\":\"admission\",\"policy\":\"" << policy << "\"";
+    for(size_t i = 0; i < scenario.carSystem.regions.size(); ++i) {
+        SyncStats& stats = scenario.carSystem.regions[i].stats;
+        std::cout << ",\"syncRegion" << i << "_cars_per_s\":" << stats.grants / seconds
+            << ",\"syncRegion" << i << "_switches\":" << stats.directionSwitches;
+    }
+    std::cout << ",\"waiting_to_spawn\":" << scenario.cars.waiting() << "}\n";
+}
+
+int main(int argc, char** argv) {
+    int maxThreads = argc > 1 ? std::stoi(argv[1]) : std::max(4u, std::thread::hardware_concurrency());
+
+    std::cout.precision(6);
+    std::cout << "{\"bench\":\"meta\",\"compiler\":\"" << __VERSION__ << "\""
+        << ",\"hardware_concurrency\":" << std::thread::hardware_concurrency() << "}\n";
+
+    benchMovement();
+    benchCoroutines();
+
+    for(int threads = 1; threads <= maxThreads; threads *= 2) {
+        benchTokens(threads, false);
+        benchTokens(threads, true);
+    }
+
+    benchScenario("standard", RoadNetwork::standard(), NUM_CARS, 100000);
+    benchScenario("standard", RoadNetwork::standard(), 1000, 100000);
+
+    benchAdmission("fifo", 100000);
+    benchAdmission("phase", 100000);
+
+    RoadNetwork city;
+    if(city.load("city.txt")) {
+        benchScenario("city.txt", city, 1000, 100000);
+        benchPartitioned("city.txt", city, 10000, maxThreads);
+    }
+
+    return 0;
+}
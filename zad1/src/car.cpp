@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+namespace chrono = std::chrono;
+using ms = std::chrono::duration<float, std::milli>;
+
+const float CAR_SIZE = 20.0f;
+
+template <typename T>
+void printVecInline(const std::vector<T>& v) {
+    for(auto& e: v) { std::cout << e << ' '; }
+}
+
+// Plain 2D vector used by the simulation, so that it doesn't depend on SFML
+// and can run without a display.
+struct Vec2 {
+    float x = 0.0f;
+    float y = 0.0f;
+
+    Vec2 operator+(const Vec2& other) const { return {x + other.x, y + other.y}; }
+    Vec2 operator-(const Vec2& other) const { return {x - other.x, y - other.y}; }
+};
+
+// Axis aligned box, same semantics as sf::FloatRect::contains.
+struct Rect {
+    float left = 0.0f;
+    float top = 0.0f;
+    float width = 0.0f;
+    float height = 0.0f;
+
+    Rect() = default;
+    Rect(float left, float top, float width, float height): left(left), top(top), width(width), height(height) {}
+    Rect(const Vec2& position, const Vec2& size): left(position.x), top(position.y), width(size.x), height(size.y) {}
+
+    bool contains(const Vec2& point) const {
+        return point.x >= left && point.x < left + width
+            && point.y >= top && point.y < top + height;
+    }
+};
+
+enum CarMoveState {
+    MOVE_RIGHT,
+    MOVE_DOWN,
+    MOVE_LEFT,
+    MOVE_UP,
+
+    MOVE_STRAIGHT_DOWN
+};
+
+// Unit vector a car in the given state moves along.
+inline Vec2 direction(CarMoveState state) {
+    switch(state) {
+    case MOVE_RIGHT: return {1.0f, 0.0f};
+    case MOVE_DOWN: return {0.0f, 1.0f};
+    case MOVE_LEFT: return {-1.0f, 0.0f};
+    case MOVE_UP: return {0.0f, -1.0f};
+    case MOVE_STRAIGHT_DOWN:
+    default: return {0.0f, 1.0f};
+    }
+}
+
+class SyncSystem;
+
+struct Car {
+    uint32_t id;
+    float speed;
+    Vec2 position;
+    Vec2 offset;
+    CarMoveState state;
+    // which loop a track car drives around, or which road a crosstrack car
+    // drives down (see RoadNetwork)
+    uint16_t road = 0;
+    // how far along its route (see RoadNetwork::routeOf) the car is
+    float distance = 0.0f;
+    bool hasToken;
+    // the intersection the token is for, while hasToken
+    uint32_t tokenRegion = 0;
+
+    // Set when a non-blocking token request failed. The car is skipped until
+    // the region releases a token, instead of asking again every update.
+    SyncSystem* parkedOn = nullptr;
+    uint32_t parkedReleases = 0;
+
+private:
+    inline static std::atomic<uint32_t> nextId = 0;
+
+    Car(uint32_t id, const Vec2& offset, float speed): id(id), speed(speed), offset(offset) {
+        hasToken = false;
+    }
+
+public:
+    Car(const Vec2& offset, float speed): offset(offset), speed(speed) {
+        hasToken = false;
+        id = nextId++;
+    }
+
+    // Rebuilds a car that already got its id, e.g. when it's read back from
+    // column storage.
+    static Car restore(uint32_t id, const Vec2& offset, float speed) {
+        return Car(id, offset, speed);
+    }
+
+    static Car spawnTrack(const Vec2& position, const Vec2& offset, float speed, uint16_t road = 0) {
+        Car car(offset, speed);
+
+        car.position = position + offset;
+        car.state = MOVE_RIGHT;
+        car.road = road;
+
+        return car;
+    }
+
+    static Car spawnCross(const Vec2& position, const Vec2& offset, float speed, uint16_t road = 0) {
+        Car car(offset, speed);
+
+        car.position = position + offset;
+        car.state = MOVE_STRAIGHT_DOWN;
+        car.road = road;
+
+        return car;
+    }
+};
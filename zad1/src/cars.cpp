@@ -1,241 +1,117 @@
-#include <SFML/Graphics.hpp>
+#pragma once
 
-#include <unordered_set>
 #include <chrono>
+#include <deque>
+#include <fstream>
 #include <iostream>
-#include <optional>
-#include <mutex>
-#include <condition_variable>
-#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 
-namespace chrono = std::chrono;
-using ms = std::chrono::duration<float, std::milli>;
+#include "car.cpp"
+#include "clock.cpp"
+#include "network.cpp"
+#include "sync.cpp"
 
-const float CAR_SIZE = 20.0f;
-
-template <typename T>
-void printVecInline(const std::vector<T>& v) {
-    for(auto& e: v) { std::cout << e << ' '; }
-}
-
-enum CarMoveState {
-    MOVE_RIGHT,
-    MOVE_DOWN,
-    MOVE_LEFT,
-    MOVE_UP,
-
-    MOVE_STRAIGHT_DOWN
-};
-
-struct Car {
-    uint32_t id;
-    float speed;
-    sf::RectangleShape shape;
-    sf::Text label;
-    sf::Vector2f offset;
-    CarMoveState state;
-    bool hasToken;
-
-private:
-    inline static uint32_t nextId = 0;
-
-public:
-    Car(const sf::Vector2f& offset, float speed): offset(offset), speed(speed) {
-        shape = sf::RectangleShape({CAR_SIZE, CAR_SIZE});
-        shape.setOrigin({CAR_SIZE / 2, CAR_SIZE / 2});
-        hasToken = false;
-        id = nextId++;
-        label.setFillColor(sf::Color::Black);
-        label.setString(std::to_string(id));
-        label.setCharacterSize(12);
-    }
-
-    static Car spawnTrack(const sf::Vector2f& position, const sf::Vector2f& offset, float speed, const sf::Font& font) {
-        Car car(offset, speed);
-
-        car.shape.setPosition(position);
-        car.shape.move(offset);
-        car.label.setPosition(car.shape.getPosition() - sf::Vector2f{CAR_SIZE / 2, CAR_SIZE / 2});
-        car.state = MOVE_RIGHT;
-
-        car.label.setFont(font);
-
-        return car;
-    }
-
-    static Car spawnCross(const sf::Vector2f& position, const sf::Vector2f& offset, float speed, const sf::Font& font) {
-        Car car(offset, speed);
-
-        car.shape.setPosition(position);
-        car.shape.move(offset);
-        car.state = MOVE_STRAIGHT_DOWN;
-
-        car.label.setFont(font);
-
-        return car;
-    }
-};
+struct CarSystem {
+    RoadNetwork network;
+    // one sync region per intersection of the network, in the same order
+    std::deque<SyncSystem> regions;
 
-class SyncSystem {
-public:
-    std::vector<std::pair<uint32_t, CarMoveState>> givenTokens;
-    static const int MAX_TOKENS = 4;
-    std::condition_variable cv;
-    std::mutex mutex;
     std::atomic<bool> exit;
-
-    sf::Text passingVehiclesText;
-    sf::RectangleShape passingVehiclesBackground;
-    std::string passingVehiclesString;
-
-    SyncSystem() {
-        passingVehiclesBackground.setSize({100.0, 40.0});
-        passingVehiclesBackground.setFillColor(sf::Color(255, 255, 255, 100));
-
-        passingVehiclesText.setCharacterSize(14);
-    }
-
-    void setTextPosition(const sf::Vector2f& position) {
-        passingVehiclesBackground.setPosition(position);
-        passingVehiclesText.setPosition(position);
+    // cars that got on the road and cars that left the screen, joined minus
+    // exited is how many are alive
+    std::atomic<uint64_t> joined = 0;
+    std::atomic<uint64_t> exited = 0;
+
+    CarSystem(const RoadNetwork& network): network(network) {
+        for(size_t i = 0; i < network.intersections.size(); ++i) {
+            regions.emplace_back().regionId = i;
+        }
     }
 
-    void draw(sf::RenderWindow& window) {
-        window.draw(passingVehiclesBackground);
-        window.draw(passingVehiclesText);
-    }
+    // Where spawns, token grants/releases and exits get recorded, if anywhere.
+    EventLog* events = nullptr;
 
-    // Save all token requests into a sorted set. To grant a token, check if:
-    // - it's at the index [0..MAX_TOKENS) after this token is released, next
-    // - there are no elements with opposing state before in the queue
-    // items will shift to the left and we'll be able to grant the token to the
-    // next item in the waiting line immediately
-    bool requestToken(const Car& car) {
-        std::unique_lock lock(mutex);
-        auto eqId = [&](const std::pair<uint32_t, CarMoveState>& pair) { return car.id == pair.first; };
-        auto pos = std::find_if(givenTokens.begin(), givenTokens.end(), eqId);
-        if(pos == std::end(givenTokens)) {
-            auto& val = givenTokens.emplace_back(std::make_pair(car.id, car.state));
-            pos = givenTokens.end() - 1;
+    void setEventLog(EventLog* log) {
+        events = log;
+        for(auto& region: regions) {
+            region.events = log;
         }
-
-        auto firstCar = givenTokens.front();
-        bool isQueuedBehindOpposingState = std::find_if(givenTokens.begin(), pos,
-            [&](std::pair<uint32_t, CarMoveState>& pair){ return car.state != pair.second;}) != pos;
-        auto matchPos = std::find_if(givenTokens.begin(), givenTokens.end(),
-            [&](std::pair<uint32_t, CarMoveState>& pair){ return car.state != pair.second;});
-
-        auto shouldPass = [&] {
-            auto pos = std::find_if(givenTokens.begin(), givenTokens.end(), eqId);
-            bool isQueuedBehindOpposingState = std::find_if(givenTokens.begin(), pos,
-                [&](std::pair<uint32_t, CarMoveState>& pair){ return car.state != pair.second;}) != pos;
-            auto shouldPass = std::distance(givenTokens.begin(), pos) < MAX_TOKENS
-            && !isQueuedBehindOpposingState;
-            return shouldPass || exit;
-        };
-
-        cv.wait(lock, shouldPass);
-
-        // oh yes, just let me write 3 lines to interpolate a string
-        // WHYYYYYY
-        std::ostringstream ss;
-        ss << car.id << " ";
-
-        passingVehiclesString.append(ss.str());
-        passingVehiclesText.setString(passingVehiclesString);
-        return true;
     }
 
-    bool releaseToken(const Car& car) {
-        std::unique_lock lock(mutex);
-        auto eqId = [&](const std::pair<uint32_t, CarMoveState>& pair) { return car.id == pair.first; };
-        auto pos = std::find_if(givenTokens.begin(), givenTokens.end(), eqId);
-        if(pos == std::end(givenTokens)) {
+    // Gives every region a new policy by name (see makeAdmissionPolicy).
+    // Returns false if there's no policy with that name.
+    bool setAdmissionPolicy(const std::string& name) {
+        if(!makeAdmissionPolicy(name)) {
             return false;
         }
-        givenTokens.erase(pos);
-
-        std::ostringstream ss;
-        ss << car.id << " ";
-        auto strPos = passingVehiclesString.find(ss.str());
-        if(strPos != passingVehiclesString.npos) {
-            passingVehiclesString.erase(strPos, ss.str().length());
-            passingVehiclesText.setString(passingVehiclesString);
+        for(auto& region: regions) {
+            region.setPolicy(makeAdmissionPolicy(name));
         }
-
-        cv.notify_all();
-
         return true;
     }
-};
-
-struct CarSystem {
-    SyncSystem syncRegion0 = SyncSystem{};
-    SyncSystem syncRegion1 = SyncSystem{};
-
-    std::atomic<bool> exit;
-
-    sf::FloatRect syncRegion0Box;
-    sf::FloatRect syncRegion1Box;
-
-    sf::FloatRect path;
-    sf::Vector2f windowSize;
 
-    CarSystem(const sf::FloatRect& path, const sf::Vector2f& syncPos0,
-        const sf::Vector2f& syncPos1, const sf::Vector2f& syncSize,
-        const sf::Vector2f windowSize, sf::Font& font) {
-            syncRegion0Box = sf::Rect<float>(syncPos0, syncSize);
-            syncRegion1Box = sf::Rect<float>(syncPos1, syncSize);
-
-            syncRegion0.setTextPosition(syncPos0 + sf::Vector2f{syncSize.x, syncSize.y});
-            syncRegion1.setTextPosition(syncPos1 + sf::Vector2f{syncSize.x, syncSize.y});
-
-            syncRegion0.passingVehiclesText.setFont(font);
-            syncRegion1.passingVehiclesText.setFont(font);
-
-            this->path = path;
-            this->windowSize = windowSize;
+    // Called by whoever puts `car` on the road: counts it as alive and records
+    // the spawn, so the run can be replayed.
+    void join(const Car& car) {
+        joined.fetch_add(1, std::memory_order_relaxed);
+        if(events) {
+            EventType type = car.state == MOVE_STRAIGHT_DOWN ? EVENT_SPAWN_CROSS : EVENT_SPAWN_TRACK;
+            events->recordSpawn(type, car.id, car.road, int8_t(car.offset.x), int8_t(car.offset.y), car.speed);
+        }
     }
 
     void shutdown() {
         exit = true;
-        syncRegion0.exit = true;
-        syncRegion1.exit = true;
-
-        syncRegion0.cv.notify_all();
-        syncRegion1.cv.notify_all();
+        for(auto& region: regions) {
+            region.shutdown();
+        }
     }
 
-    void draw(sf::RenderWindow& window) {
-        syncRegion0.draw(window);
-        syncRegion1.draw(window);
+    void writeTelemetryJson(std::ostream& out) {
+        out << "{";
+        for(size_t i = 0; i < regions.size(); ++i) {
+            out << (i ? "," : "") << "\"syncRegion" << i << "\":";
+            regions[i].stats.writeJson(out);
+        }
+        out << "}\n";
     }
 
-    std::unordered_set<size_t> removeSet;
-
-    // TODO fix deleting on wrong indexes
-    void update(std::vector<Car>& cars) {
-        for(auto i = cars.begin(); i != cars.end(); ++i) {
-            bool shouldRemove = updateCar(*i, false);
-            if(shouldRemove) {
-                size_t idx = i - cars.begin();
-                removeSet.insert(idx);
-            }
+    void writeTelemetryCsv(std::ostream& out) {
+        SyncStats::writeCsvHeader(out);
+        for(size_t i = 0; i < regions.size(); ++i) {
+            regions[i].stats.writeCsv(out, "syncRegion" + std::to_string(i));
         }
+    }
 
-            for(auto idx: removeSet) {
-                cars.erase(cars.begin() + idx);
-            }
-            removeSet.clear();
+    // Writes telemetry to `path`, as CSV if it ends with .csv, JSON otherwise.
+    void writeTelemetry(const std::string& path) {
+        std::ofstream out(path);
+        if(path.ends_with(".csv")) {
+            writeTelemetryCsv(out);
+        } else {
+            writeTelemetryJson(out);
         }
+        std::cout << "telemetry written to " << path << "\n";
+    }
 
-    void updateCarSync(Car& car) {
-        while(!exit) {
-            std::this_thread::sleep_for(chrono::microseconds(8333));
-            updateCar(car, true);
-
-            if(car.shape.getPosition().y > windowSize.y && car.state == MOVE_STRAIGHT_DOWN) {
-                break;
+    // Drives one car from its own thread, one step for every tick of `clock`.
+    // If the thread wakes up late it catches up on the ticks it missed.
+    // `published` gets the position after every wakeup, for threads that want
+    // to read it while this one keeps moving the car. Returns when the car
+    // leaves the screen, or on shutdown or `stop`.
+    void updateCarSync(Car& car, SimClock& clock, std::atomic<Vec2>* published = nullptr, std::stop_token stop = {}) {
+        uint64_t carTick = clock.now();
+        bool finished = false;
+        while(!exit && !finished && !stop.stop_requested()) {
+            uint64_t now = clock.waitFor(carTick + 1);
+            for(; carTick < now && !exit && !finished && !stop.stop_requested(); ++carTick) {
+                updateCar(car, true);
+                finished = car.position.y > network.size.y && car.state == MOVE_STRAIGHT_DOWN;
+            }
+            if(published) {
+                published->store(car.position, std::memory_order_relaxed);
             }
         }
         std::cout << "thread of car " << car.id << " exiting\n";
@@ -243,95 +119,64 @@ struct CarSystem {
 
     // Tries to synchronize access to sync regions using their request/release
     // Token methods. Returns true if car can move, and false if it can't.
-    bool syncCrosses(Car& car, const sf::Vector2f& nextPosition, bool threadUpdate) {
-        std::optional<std::reference_wrapper<SyncSystem>> syncRegion;
+    // Without threadUpdate the car shares its thread with other cars, so
+    // waiting for a token would block everyone; the car just stays in place.
+    bool syncCrosses(Car& car, const Vec2& nextPosition, bool threadUpdate) {
+        int32_t syncRegion = network.intersectionAt(nextPosition);
         bool canMove = true;
-        if(syncRegion0Box.contains(nextPosition)) {
-            syncRegion = syncRegion0;
-        } else if(syncRegion1Box.contains(nextPosition)) {
-            syncRegion = syncRegion1;
-        } else {
-            if(car.hasToken) {
-                syncRegion0.releaseToken(car);
-                syncRegion1.releaseToken(car);
-                car.hasToken = false;
-            }
+        if(car.hasToken && int32_t(car.tokenRegion) != syncRegion) {
+            regions[car.tokenRegion].releaseToken(car);
+            car.hasToken = false;
         }
 
-        if(syncRegion.has_value()) {
-            car.hasToken = car.hasToken || syncRegion.value().get().requestToken(car);
+        if(syncRegion >= 0) {
+            SyncSystem& region = regions[syncRegion];
+            car.tokenRegion = syncRegion;
+            if(!car.hasToken && threadUpdate) {
+                car.hasToken = region.requestToken(car);
+            } else if(!car.hasToken) {
+                uint32_t releases = region.releases;
+                car.hasToken = region.tryRequestToken(car);
+                car.parkedOn = car.hasToken ? nullptr : &region;
+                car.parkedReleases = releases;
+            }
             canMove = car.hasToken;
         }
         return canMove;
     }
 
     bool updateCar(Car& car, bool threadUpdate) {
-        auto pos = car.shape.getPosition();
-        float newX = 0, newY = 0;
-
-        float path_start_x = path.left + car.offset.x;
-        float path_end_x = path.left + path.width + car.offset.x;
-        float path_start_y = path.top + car.offset.y;
-        float path_end_y = path.top + path.height + car.offset.y;
-
-        sf::Vector2f nextPosition;
-
-        switch (car.state) {
-        case MOVE_RIGHT:
-            newX = pos.x + car.speed;
-            if(newX >= path_end_x) {
-                car.state = MOVE_DOWN;
-                newX = path_end_x;
-            }
-            nextPosition = car.shape.getPosition() + sf::Vector2f{newX - pos.x, 0.0};
-            break;
-
-        case MOVE_DOWN:
-            newY = pos.y + car.speed;
-            if(newY >= path_end_y) {
-                car.state = MOVE_LEFT;
-                newY = path_end_y;
-            }
-            nextPosition = car.shape.getPosition() + sf::Vector2f{0.0, newY - pos.y};
-            break;
-
-        case MOVE_LEFT:
-            newX = pos.x - car.speed;
-            if(newX <= path_start_x) {
-                car.state = MOVE_UP;
-                newX = path_start_x;
-            }
-            nextPosition = car.shape.getPosition() + sf::Vector2f{newX - pos.x, 0.0};
-            break;
-
-        case MOVE_UP:
-            newY = pos.y - car.speed;
-            if(newY <= path_start_y) {
-                car.state = MOVE_RIGHT;
-                newX = path_start_y;
-            }
-            nextPosition = car.shape.getPosition() + sf::Vector2f{0.0, newY - pos.y};
-            break;
-
-        case MOVE_STRAIGHT_DOWN:
-            newY = pos.y + car.speed;
-            nextPosition = car.shape.getPosition() + sf::Vector2f{0.0, newY - pos.y};
-            break;
+        return updateCar(car, threadUpdate, car.speed);
+    }
 
-        default:
-            break;
+    // Moves the car by `distance` instead of its own speed, e.g. when it's
+    // stuck behind a slower one.
+    bool updateCar(Car& car, bool threadUpdate, float distance) {
+        if(car.parkedOn && car.parkedOn->releases == car.parkedReleases) {
+            return false;
         }
 
+        const Route& route = network.routeOf(car);
+        float nextDistance = route.advance(car.distance, distance);
+        const Segment& segment = route.segments[route.segmentAt(nextDistance)];
+        Vec2 nextPosition = segment.pointAt(nextDistance) + car.offset;
+        // the direction the car asks for a token in is where it's going
+        car.state = segment.state;
+
         // here check if we're trying to move on sync region
         bool canMove = true;
         canMove = syncCrosses(car, nextPosition, threadUpdate);
 
         if(canMove) {
-            car.shape.setPosition(nextPosition);
-            car.label.setPosition(nextPosition - sf::Vector2f{CAR_SIZE / 2, CAR_SIZE / 2});
+            car.position = nextPosition;
+            car.distance = nextDistance;
         }
 
-        if(nextPosition.y > windowSize.y) {
+        if(nextPosition.y > network.size.y) {
+            exited.fetch_add(1, std::memory_order_relaxed);
+            if(events) {
+                events->record(EVENT_EXIT, car.id);
+            }
             return true;
         }
         return false;
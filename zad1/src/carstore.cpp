@@ -0,0 +1,285 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "cars.cpp"
+#include "snapshot.cpp"
+#include "spatial.cpp"
+#include "spawner.cpp"
+
+// Cars for the single threaded update, stored column by column so that the
+// common case - a car driving along a segment of its route, away from any
+// sync region - can be done for 4 cars at once. Everything else (corners,
+// sync regions, leaving the screen) goes through CarSystem::updateCar.
+//
+// With carFollowing a car doesn't drive into the one ahead of it in its lane
+// but slows down behind it (see followDistance), and spawned cars wait at
+// their spawn point until their spot is clear.
+struct CarStore {
+    bool carFollowing = true;
+
+    std::vector<uint32_t> id;
+    std::vector<float> x, y;
+    std::vector<float> speed;
+    std::vector<float> offsetX, offsetY;
+    std::vector<CarMoveState> state;
+    std::vector<uint16_t> road;
+    std::vector<uint32_t> tokenRegion;
+
+    // how far along its route the car is, the unit vector of the segment
+    // it's on and the distance that segment ends at
+    std::vector<float> distance;
+    std::vector<float> dirX, dirY;
+    std::vector<float> segmentEnd;
+
+    // non zero when the car has to take the slow path: FLAG_TOKEN while it
+    // holds a token, FLAG_PARKED while it's waiting for one
+    std::vector<uint32_t> flags;
+    std::vector<SyncSystem*> parkedOn;
+    std::vector<uint32_t> parkedReleases;
+
+    static const uint32_t FLAG_TOKEN = 1;
+    static const uint32_t FLAG_PARKED = 2;
+
+    size_t size() const {
+        return id.size();
+    }
+
+    size_t waiting() const {
+        return pending.size();
+    }
+
+    // Cars that found their spawn point full.
+    uint64_t turnedAway() const {
+        return pending.turnedAway();
+    }
+
+    // The car joins on the first step its spot is free. Returns false if it
+    // was turned away instead.
+    bool spawn(const Car& car) {
+        return pending.push(car);
+    }
+
+    void add(const Car& car, const CarSystem& carSystem) {
+        id.push_back(car.id);
+        x.push_back(car.position.x);
+        y.push_back(car.position.y);
+        speed.push_back(car.speed);
+        offsetX.push_back(car.offset.x);
+        offsetY.push_back(car.offset.y);
+        state.push_back(car.state);
+        road.push_back(car.road);
+        tokenRegion.push_back(car.tokenRegion);
+        distance.push_back(0.0f);
+        dirX.push_back(0.0f);
+        dirY.push_back(0.0f);
+        segmentEnd.push_back(0.0f);
+        flags.push_back(0);
+        parkedOn.push_back(nullptr);
+        parkedReleases.push_back(0);
+        store(size() - 1, car, carSystem);
+    }
+
+    Car get(size_t i) const {
+        Car car = Car::restore(id[i], {offsetX[i], offsetY[i]}, speed[i]);
+        car.position = {x[i], y[i]};
+        car.state = state[i];
+        car.road = road[i];
+        car.distance = distance[i];
+        car.hasToken = flags[i] & FLAG_TOKEN;
+        car.tokenRegion = tokenRegion[i];
+        car.parkedOn = parkedOn[i];
+        car.parkedReleases = parkedReleases[i];
+        return car;
+    }
+
+    void snapshot(Snapshot& snapshot) const {
+        snapshot.cars.clear();
+        for(size_t i = 0; i < size(); ++i) {
+            snapshot.cars.push_back({{x[i], y[i]}, id[i]});
+        }
+    }
+
+    // Moves the last car into slot i.
+    void remove(size_t i) {
+        auto removeAt = [&](auto& column) {
+            column[i] = column.back();
+            column.pop_back();
+        };
+        removeAt(id); removeAt(x); removeAt(y); removeAt(speed);
+        removeAt(offsetX); removeAt(offsetY); removeAt(state);
+        removeAt(road); removeAt(tokenRegion);
+        removeAt(distance); removeAt(dirX); removeAt(dirY); removeAt(segmentEnd);
+        removeAt(flags); removeAt(parkedOn); removeAt(parkedReleases);
+    }
+
+    void step(CarSystem& carSystem) {
+        auto position = [&](size_t j) { return Vec2{x[j], y[j]}; };
+        auto dir = [&](size_t j) { return Vec2{dirX[j], dirY[j]}; };
+
+        // cars spawned now aren't in the grid, they start following next step
+        if(carFollowing) {
+            grid.build(size(), position);
+        }
+        admitPending(carSystem, position);
+
+        advance.assign(speed.begin(), speed.end());
+        if(carFollowing) {
+            for(size_t i = 0; i < size(); ++i) {
+                advance[i] = followDistance(grid, i, speed[i], position, dir);
+            }
+        }
+
+        slow.clear();
+        moveStraight(carSystem);
+
+        finished.clear();
+        for(auto i: slow) {
+            if(parkedOn[i] && parkedOn[i]->releases == parkedReleases[i]) {
+                continue;
+            }
+            Car car = get(i);
+            if(carSystem.updateCar(car, false, advance[i])) {
+                finished.push_back(i);
+            }
+            store(i, car, carSystem);
+        }
+
+        // slow is ascending, so removing from the back keeps the indexes valid
+        for(auto i = finished.rbegin(); i != finished.rend(); ++i) {
+            remove(*i);
+        }
+    }
+
+private:
+    // how far each car moves this step
+    std::vector<float> advance;
+    SpatialHash grid;
+    SpawnQueues pending;
+
+    std::vector<uint32_t> slow;
+    std::vector<uint32_t> finished;
+
+    template <typename Position>
+    void admitPending(CarSystem& carSystem, Position position) {
+        size_t inGrid = size();
+        pending.admit([&](const Car& car) {
+            bool free = !carFollowing || isFree(grid, position, car.position);
+            for(size_t j = inGrid; j < size() && free; ++j) {
+                Vec2 d = position(j) - car.position;
+                free = std::abs(d.x) >= CAR_SIZE || std::abs(d.y) >= CAR_SIZE;
+            }
+            if(free) {
+                add(car, carSystem);
+                carSystem.join(car);
+            }
+            return free;
+        });
+    }
+
+    void store(size_t i, const Car& car, const CarSystem& carSystem) {
+        x[i] = car.position.x;
+        y[i] = car.position.y;
+        state[i] = car.state;
+        tokenRegion[i] = car.tokenRegion;
+        flags[i] = (car.hasToken ? FLAG_TOKEN : 0) | (car.parkedOn ? FLAG_PARKED : 0);
+        parkedOn[i] = car.parkedOn;
+        parkedReleases[i] = car.parkedReleases;
+
+        const Route& route = carSystem.network.routeOf(car);
+        size_t segment = route.segmentAt(car.distance);
+        distance[i] = car.distance;
+        dirX[i] = route.segments[segment].dir.x;
+        dirY[i] = route.segments[segment].dir.y;
+        segmentEnd[i] = route.segmentEnd(segment);
+    }
+
+    // Moves every car that stays on the segment it's on, outside the sync
+    // regions and the screen, and collects the rest into `slow`.
+    void moveStraight(const CarSystem& carSystem) {
+        const RoadNetwork& network = carSystem.network;
+        const float maxY = network.size.y;
+        size_t n = size();
+        size_t i = 0;
+
+#ifdef __SSE2__
+        const __m128i laneBits = _mm_setr_epi32(1, 2, 4, 8);
+        const Rect bounds = network.intersectionBounds();
+        auto inBox = [](__m128 nx, __m128 ny, const Rect& box) {
+            __m128 inX = _mm_and_ps(_mm_cmpge_ps(nx, _mm_set1_ps(box.left)),
+                _mm_cmplt_ps(nx, _mm_set1_ps(box.left + box.width)));
+            __m128 inY = _mm_and_ps(_mm_cmpge_ps(ny, _mm_set1_ps(box.top)),
+                _mm_cmplt_ps(ny, _mm_set1_ps(box.top + box.height)));
+            return _mm_and_ps(inX, inY);
+        };
+        auto select = [](__m128 mask, __m128 a, __m128 b) {
+            return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+        };
+
+        for(; i + 4 <= n; i += 4) {
+            __m128 px = _mm_loadu_ps(&x[i]);
+            __m128 py = _mm_loadu_ps(&y[i]);
+            __m128 s = _mm_loadu_ps(&advance[i]);
+            __m128 nx = _mm_add_ps(px, _mm_mul_ps(_mm_loadu_ps(&dirX[i]), s));
+            __m128 ny = _mm_add_ps(py, _mm_mul_ps(_mm_loadu_ps(&dirY[i]), s));
+            __m128 nd = _mm_add_ps(_mm_loadu_ps(&distance[i]), s);
+            __m128i f = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&flags[i]));
+
+            __m128 fast = _mm_castsi128_ps(_mm_cmpeq_epi32(f, _mm_setzero_si128()));
+            fast = _mm_and_ps(fast, _mm_cmplt_ps(nd, _mm_loadu_ps(&segmentEnd[i])));
+            fast = _mm_and_ps(fast, _mm_cmple_ps(ny, _mm_set1_ps(maxY)));
+
+            // lanes still fast and near an intersection look their next
+            // position up in the index, one at a time
+            int nearLanes = _mm_movemask_ps(_mm_and_ps(fast, inBox(nx, ny, bounds)));
+            if(nearLanes) {
+                int fastLanes = _mm_movemask_ps(fast);
+                alignas(16) float nxs[4], nys[4];
+                _mm_store_ps(nxs, nx);
+                _mm_store_ps(nys, ny);
+                for(int lanes = nearLanes; lanes; lanes &= lanes - 1) {
+                    int lane = __builtin_ctz(lanes);
+                    if(network.intersectionAt({nxs[lane], nys[lane]}) >= 0) {
+                        fastLanes &= ~(1 << lane);
+                    }
+                }
+                __m128i bits = _mm_and_si128(_mm_set1_epi32(fastLanes), laneBits);
+                fast = _mm_castsi128_ps(_mm_cmpeq_epi32(bits, laneBits));
+            }
+
+            _mm_storeu_ps(&x[i], select(fast, nx, px));
+            _mm_storeu_ps(&y[i], select(fast, ny, py));
+            _mm_storeu_ps(&distance[i], select(fast, nd, _mm_loadu_ps(&distance[i])));
+
+            int slowLanes = ~_mm_movemask_ps(fast) & 0xf;
+            while(slowLanes) {
+                int lane = __builtin_ctz(slowLanes);
+                slow.push_back(i + lane);
+                slowLanes &= slowLanes - 1;
+            }
+        }
+#endif
+
+        for(; i < n; ++i) {
+            float nx = x[i] + dirX[i] * advance[i];
+            float ny = y[i] + dirY[i] * advance[i];
+            float nd = distance[i] + advance[i];
+            bool fast = flags[i] == 0 && nd < segmentEnd[i] && ny <= maxY
+                && network.intersectionAt({nx, ny}) < 0;
+            if(fast) {
+                x[i] = nx;
+                y[i] = ny;
+                distance[i] = nd;
+            } else {
+                slow.push_back(i);
+            }
+        }
+    }
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+namespace chrono = std::chrono;
+
+// Simulated time, counted in fixed ticks of 1/120 s. A car moves `speed`
+// pixels per tick, so how far it gets only depends on how many ticks passed,
+// not on how the threads moving it were scheduled.
+//
+// With realTime the ticks follow the wall clock, without it the clock runs as
+// fast as the simulation can keep up.
+class SimClock {
+public:
+    static const int TICKS_PER_SECOND = 120;
+    static constexpr chrono::nanoseconds TICK = chrono::nanoseconds(1'000'000'000 / TICKS_PER_SECOND);
+
+    // Never catch up more than this many ticks in a row, e.g. after the
+    // process was stopped for a while; the rest of the backlog is dropped.
+    static const uint64_t MAX_CATCH_UP = TICKS_PER_SECOND / 10;
+
+    const bool realTime;
+
+    SimClock(bool realTime = true): realTime(realTime) {
+        nextTick = chrono::steady_clock::now();
+    }
+
+    uint64_t now() const {
+        return ticks.load(std::memory_order_acquire);
+    }
+
+    // For a thread that only drives the clock: waits until the next tick is
+    // due and advances by one.
+    uint64_t advanceNext() {
+        if(realTime) {
+            nextTick += TICK;
+            // more than MAX_CATCH_UP ticks behind, e.g. after a stall: drop
+            // the backlog instead of racing through it
+            auto current = chrono::steady_clock::now();
+            if(current - nextTick > MAX_CATCH_UP * TICK) {
+                nextTick = current;
+            }
+            std::this_thread::sleep_until(nextTick);
+        }
+        advance(1);
+        return now();
+    }
+
+    // Blocks until the clock reaches `tick` or is stopped. Returns the
+    // current tick.
+    uint64_t waitFor(uint64_t tick) {
+        uint64_t current = now();
+        while(current < tick && !stopped) {
+            ticks.wait(current, std::memory_order_acquire);
+            current = now();
+        }
+        return current;
+    }
+
+    void stop() {
+        stopped = true;
+        ticks.fetch_add(1, std::memory_order_release);
+        ticks.notify_all();
+    }
+
+private:
+    std::atomic<uint64_t> ticks = 0;
+    std::atomic<bool> stopped = false;
+
+    chrono::steady_clock::time_point nextTick;
+
+    void advance(uint64_t n) {
+        if(n == 0) {
+            return;
+        }
+        ticks.fetch_add(n, std::memory_order_release);
+        ticks.notify_all();
+    }
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "clock.cpp"
+
+enum EventType: uint8_t {
+    EVENT_SPAWN_TRACK,
+    EVENT_SPAWN_CROSS,
+    EVENT_GRANT,
+    EVENT_RELEASE,
+    EVENT_EXIT
+};
+
+inline const char* eventName(uint8_t type) {
+    switch(type) {
+    case EVENT_SPAWN_TRACK: return "spawn_track";
+    case EVENT_SPAWN_CROSS: return "spawn_cross";
+    case EVENT_GRANT: return "grant";
+    case EVENT_RELEASE: return "release";
+    case EVENT_EXIT: return "exit";
+    default: return "unknown";
+    }
+}
+
+// One thing that happened in a run. Spawns fill road, offset and speed
+// (enough to spawn the same car again), grants and releases fill region.
+struct Event {
+    uint32_t tick;
+    uint32_t car;
+    uint8_t type;
+    int8_t offsetX;
+    int8_t offsetY;
+    uint8_t unused = 0;
+    uint16_t region;
+    uint16_t road;
+    float speed;
+
+    bool operator==(const Event& other) const {
+        return std::memcmp(this, &other, sizeof(Event)) == 0;
+    }
+};
+static_assert(sizeof(Event) == 20);
+
+// Binary log of a run, kept in a ring buffer allocated up front so recording
+// never allocates. Any thread can record: a slot is claimed with one atomic
+// add and then written, every event gets the current tick of `clock`. When
+// the ring is full the oldest events are overwritten and counted as dropped.
+//
+// events() and write() must only be called when nobody is recording.
+class EventLog {
+public:
+    static const uint32_t MAGIC = 0x47'4c'52'54; // "TRLG"
+    static const uint32_t VERSION = 2;
+
+    EventLog(const SimClock& clock, size_t capacity = 1 << 20)
+        : clock(clock), ring(std::bit_ceil(capacity)), mask(ring.size() - 1) {}
+
+    void record(EventType type, uint32_t car, uint16_t region = 0) {
+        uint64_t i = head.fetch_add(1, std::memory_order_relaxed);
+        ring[i & mask] = {uint32_t(clock.now()), car, type, 0, 0, 0, region, 0, 0.0f};
+    }
+
+    void recordSpawn(EventType type, uint32_t car, uint16_t road, int8_t offsetX, int8_t offsetY, float speed) {
+        uint64_t i = head.fetch_add(1, std::memory_order_relaxed);
+        ring[i & mask] = {uint32_t(clock.now()), car, type, offsetX, offsetY, 0, 0, road, speed};
+    }
+
+    uint64_t recorded() const {
+        return head.load(std::memory_order_relaxed);
+    }
+
+    uint64_t dropped() const {
+        uint64_t n = recorded();
+        return n > ring.size() ? n - ring.size() : 0;
+    }
+
+    // The events still in the ring, oldest first.
+    std::vector<Event> events() const {
+        uint64_t n = recorded();
+        std::vector<Event> out;
+        out.reserve(n - dropped());
+        for(uint64_t i = dropped(); i < n; ++i) {
+            out.push_back(ring[i & mask]);
+        }
+        return out;
+    }
+
+    void write(const std::string& path) const {
+        std::ofstream out(path, std::ios::binary);
+        std::vector<Event> all = events();
+        Header header{MAGIC, VERSION, all.size(), dropped()};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(all.data()), all.size() * sizeof(Event));
+        std::cout << "events written to " << path << " (" << all.size() << " events, "
+            << header.dropped << " dropped)\n";
+    }
+
+    // Reads a log written by write(). Returns false if the file isn't one;
+    // `dropped` tells how many of the oldest events were lost while recording.
+    static bool read(const std::string& path, std::vector<Event>& events, uint64_t& dropped) {
+        std::ifstream in(path, std::ios::binary);
+        Header header;
+        if(!in.read(reinterpret_cast<char*>(&header), sizeof(header))
+            || header.magic != MAGIC || header.version != VERSION) {
+            return false;
+        }
+        events.resize(header.count);
+        dropped = header.dropped;
+        return bool(in.read(reinterpret_cast<char*>(events.data()), header.count * sizeof(Event)));
+    }
+
+private:
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t count;
+        uint64_t dropped;
+    };
+
+    const SimClock& clock;
+    std::vector<Event> ring;
+    uint64_t mask;
+    alignas(64) std::atomic<uint64_t> head = 0;
+};
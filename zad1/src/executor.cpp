@@ -0,0 +1,163 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <vector>
+
+#include "cars.cpp"
+#include "slab.cpp"
+
+// Coroutine returned by CarExecutor::drive. It starts suspended and frees its
+// own frame when the car is done.
+struct CarTask {
+    struct promise_type {
+        CarTask get_return_object() {
+            return {std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+// Every car is a coroutine instead of a thread: it co_awaits the next tick,
+// and when it's queued for a token it co_awaits being let in, so a waiting
+// car costs its coroutine frame and a slot in `agents` instead of a thread
+// and its stack.
+//
+// All the cars run on the thread calling runTick. Tokens are only granted
+// when a car asks or releases, which also happens on that thread, so the
+// executor doesn't lock anything but the spawn queue.
+class CarExecutor {
+public:
+    CarExecutor(CarSystem& carSystem): carSystem(carSystem) {}
+
+    CarExecutor(const CarExecutor&) = delete;
+    CarExecutor& operator=(const CarExecutor&) = delete;
+
+    ~CarExecutor() {
+        // the frame goes away after the car gave back its place in line, so
+        // no region is left pointing into it
+        agents.forEach([&](Agent& agent) {
+            leaveRegions(agent.car);
+            agent.task.destroy();
+        });
+    }
+
+    // Can be called from any thread, the car starts driving on the next tick.
+    void spawn(const Car& car) {
+        std::unique_lock lock(pendingMutex);
+        pending.push_back(car);
+    }
+
+    // Resumes every car due this tick. Cars let into a sync region during
+    // the tick move on the next one.
+    void runTick() {
+        {
+            std::unique_lock lock(pendingMutex);
+            for(auto& car: pending) {
+                auto slot = agents.create(car);
+                Agent& agent = agents.get(slot);
+                agent.task = drive(slot).handle;
+                next.push_back(agent.task);
+            }
+            pending.clear();
+        }
+
+        std::swap(due, next);
+        for(auto task: due) {
+            task.resume();
+        }
+        due.clear();
+    }
+
+    size_t size() const {
+        return agents.size();
+    }
+
+    template <typename F>
+    void forEachCar(F f) {
+        agents.forEach([&](Agent& agent) { f(agent.car); });
+    }
+
+private:
+    struct Agent {
+        Car car;
+        std::coroutine_handle<> task;
+
+        Agent(const Car& car): car(car) {}
+    };
+
+    CarSystem& carSystem;
+    SlabPool<Agent> agents;
+
+    std::mutex pendingMutex;
+    std::vector<Car> pending;
+
+    // cars to resume this tick and the next one
+    std::vector<std::coroutine_handle<>> due;
+    std::vector<std::coroutine_handle<>> next;
+
+    struct NextTick {
+        CarExecutor& executor;
+
+        bool await_ready() { return false; }
+        void await_suspend(std::coroutine_handle<> task) { executor.next.push_back(task); }
+        void await_resume() {}
+    };
+
+    // Suspends until the region lets the car in, or just until the next tick
+    // if it already did.
+    struct Granted: GrantListener {
+        CarExecutor& executor;
+        SyncSystem& region;
+        const Car& car;
+        std::coroutine_handle<> task;
+
+        Granted(CarExecutor& executor, SyncSystem& region, const Car& car): executor(executor), region(region), car(car) {}
+
+        bool await_ready() { return false; }
+        void await_suspend(std::coroutine_handle<> task) {
+            this->task = task;
+            if(!region.notifyOnGrant(car, this)) {
+                executor.next.push_back(task);
+            }
+        }
+        void await_resume() {}
+
+        void granted() override {
+            executor.next.push_back(task);
+        }
+    };
+
+    // One step a tick, the same as the worker pool, but a car that didn't get
+    // its token sleeps until it does instead of being skipped every tick.
+    CarTask drive(SlabPool<Agent>::Handle slot) {
+        Car& car = agents.get(slot).car;
+        while(!carSystem.exit && !carSystem.updateCar(car, false)) {
+            if(car.parkedOn) {
+                co_await Granted(*this, *car.parkedOn, car);
+                // it holds the token from now on, not from its next step, so
+                // leaveRegions gives it back even if the loop ends first
+                car.hasToken = true;
+                car.parkedOn = nullptr;
+            } else {
+                co_await NextTick{*this};
+            }
+        }
+        leaveRegions(car);
+        agents.destroy(slot);
+    }
+
+    void leaveRegions(Car& car) {
+        if(car.parkedOn) {
+            car.parkedOn->releaseToken(car);
+        } else if(car.hasToken) {
+            carSystem.regions[car.tokenRegion].releaseToken(car);
+        }
+    }
+};
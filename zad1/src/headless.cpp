@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include "scenario.cpp"
+#include "shm.cpp"
+#include "trace.cpp"
+
+// Runs the simulation without a window: all cars are stepped on this thread,
+// one CarStore::step per SimClock tick, as fast as the machine allows.
+//
+// usage: headless [ticks] [track cars] [seed] [telemetry.json|telemetry.csv] [events.bin] [roads.txt] [spawns.txt] [fifo|phase] [/ring] [trace.json]
+//
+// With an events path the run is recorded, see replay.cpp. Pass "" to skip
+// telemetry or recording. Without a roads file it's the track from layout.cpp.
+// With a spawns file (see spawner.cpp) the cars come from it and the number
+// of track cars is ignored. The next one picks how the sync regions let cars
+// in, see admission.cpp.
+//
+// With a ring name (like /traffic) it's a server: every tick goes into a
+// SnapshotRing in shared memory for viewers to watch (see viewer.cpp), and
+// the ticks are paced to real time so there's something to watch. With a
+// trace path every tick is traced and written there, see trace.cpp.
+
+// Most cars a ring snapshot holds when the spawns file doesn't cap them.
+const uint32_t RING_CAPACITY = 1 << 16;
+
+int main(int argc, char** argv) {
+    uint64_t numTicks = argc > 1 ? std::stoull(argv[1]) : 100000;
+    int numTrackCars = argc > 2 ? std::stoi(argv[2]) : NUM_CARS;
+    uint32_t seed = argc > 3 ? std::stoul(argv[3]) : 0;
+    std::string telemetryPath = argc > 4 ? argv[4] : "";
+    std::string eventsPath = argc > 5 ? argv[5] : "";
+
+    RoadNetwork network = RoadNetwork::standard();
+    if(argc > 6 && *argv[6] && !network.load(argv[6])) {
+        return 1;
+    }
+
+    std::optional<SpawnPlan> plan;
+    if(argc > 7 && *argv[7] && !plan.emplace().load(argv[7], network)) {
+        return 1;
+    }
+
+    std::optional<Scenario> scenarioStorage;
+    if(plan) {
+        scenarioStorage.emplace(network, *plan, seed);
+    } else {
+        scenarioStorage.emplace(network, numTrackCars, seed);
+    }
+    Scenario& scenario = *scenarioStorage;
+    if(argc > 8 && *argv[8] && !scenario.carSystem.setAdmissionPolicy(argv[8])) {
+        std::cerr << "unknown admission policy " << argv[8] << "\n";
+        return 1;
+    }
+    std::optional<EventLog> events;
+    if(!eventsPath.empty()) {
+        events.emplace(scenario.clock);
+        scenario.carSystem.setEventLog(&*events);
+    }
+
+    std::optional<SnapshotRing> ring;
+    if(argc > 9 && *argv[9]
+        && !ring.emplace().create(argv[9], plan ? plan->maxAlive : RING_CAPACITY, CellGrid::over(network.size))) {
+        return 1;
+    }
+    Snapshot snapshot;
+
+    std::string tracePath = argc > 10 ? argv[10] : "";
+    if(!tracePath.empty()) {
+        Tracer::get().nameThread("headless");
+        Tracer::get().start();
+    }
+
+    auto start = chrono::steady_clock::now();
+
+    for(uint64_t tick = 0; tick < numTicks; ++tick) {
+        TraceSpan span("tick", "tick", tick);
+        scenario.step();
+        if(ring) {
+            snapshot.tick = scenario.tick();
+            scenario.cars.snapshot(snapshot);
+            snapshot.arrange(network.size);
+            ring->publish(snapshot);
+            span.end();
+            std::this_thread::sleep_until(start + SimClock::TICK * (tick + 1));
+        }
+    }
+
+    float elapsed = chrono::duration_cast<ms>(chrono::steady_clock::now() - start).count();
+
+    std::cout.precision(3);
+    std::cout << "intersections: " << network.intersections.size() << "   ";
+    std::cout << "ticks: " << numTicks << "   ";
+    std::cout << "simulated: " << std::fixed << numTicks / float(SimClock::TICKS_PER_SECOND) << " s   ";
+    std::cout << "spawned: " << scenario.spawned() << "   ";
+    std::cout << "alive: " << scenario.cars.size() << "   ";
+    std::cout << "waiting to spawn: " << scenario.cars.waiting() << "   ";
+    std::cout << "throttled: " << scenario.throttled() << "   ";
+    for(size_t i = 0; i < std::min<size_t>(2, scenario.carSystem.regions.size()); ++i) {
+        std::cout << "syncRegion" << i << ": " << std::fixed
+            << scenario.carSystem.regions[i].stats.grants / (numTicks / float(SimClock::TICKS_PER_SECOND)) << " cars/s   ";
+    }
+    std::cout << "elapsed: " << std::fixed << elapsed << " ms   ";
+    std::cout << "ticks/s: " << std::fixed << numTicks / (elapsed / 1000.0f) << '\n';
+
+    if(!telemetryPath.empty()) {
+        scenario.carSystem.writeTelemetry(telemetryPath);
+    }
+    if(events) {
+        events->write(eventsPath);
+    }
+    if(!tracePath.empty()) {
+        Tracer::get().stop();
+        Tracer::get().write(tracePath);
+    }
+
+    return 0;
+}
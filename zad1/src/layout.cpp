@@ -0,0 +1,25 @@
+#pragma once
+
+// Geometry of the built in track (RoadNetwork::standard), shared by the
+// windowed and the headless build. The sync regions are where the crosstrack
+// crosses the track.
+const int WINDOW_WIDTH = 800, WINDOW_HEIGHT = 600;
+const int TRACK_WIDTH = WINDOW_WIDTH / 2, TRACK_HEIGHT = WINDOW_HEIGHT / 2;
+const float TRACK_THICKNESS = 100.0f;
+
+const float PATH_START_X = (WINDOW_WIDTH - TRACK_WIDTH - TRACK_THICKNESS) / 2;
+const float PATH_START_Y = (WINDOW_HEIGHT - TRACK_HEIGHT - TRACK_THICKNESS) / 2;
+
+const float PATH_END_X = (WINDOW_WIDTH - TRACK_THICKNESS * 1.5 );
+const float PATH_END_Y = (WINDOW_HEIGHT - TRACK_THICKNESS * 1.0 );
+
+const float PATH_SIZE_X = PATH_END_X - PATH_START_X;
+const float PATH_SIZE_Y = PATH_END_Y - PATH_START_Y;
+
+const int CROSSTRACK_X = WINDOW_WIDTH * 0.5;
+const int CROSSTRACK_WIDTH = 100;
+
+const float CAR_SPEED_MIN = 0.5f;
+const float CAR_SPEED_MAX = 2.0f;
+
+const int NUM_CARS = 20;
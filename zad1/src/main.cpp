@@ -9,38 +9,70 @@
 #include <optional>
 #include <SFML/Graphics.hpp>
 
-#include "cars.cpp"
-
-const int WINDOW_WIDTH = 800, WINDOW_HEIGHT = 600;
-const int TRACK_WIDTH = WINDOW_WIDTH / 2, TRACK_HEIGHT = WINDOW_HEIGHT / 2;
-const float TRACK_THICKNESS = 100.0f;
-
-const float PATH_START_X = (WINDOW_WIDTH - TRACK_WIDTH - TRACK_THICKNESS) / 2;
-const float PATH_START_Y = (WINDOW_HEIGHT - TRACK_HEIGHT - TRACK_THICKNESS) / 2;
-
-const float PATH_END_X = (WINDOW_WIDTH - TRACK_THICKNESS * 1.5 );
-const float PATH_END_Y = (WINDOW_HEIGHT - TRACK_THICKNESS * 1.0 );
-
-const float PATH_SIZE_X = PATH_END_X - PATH_START_X;
-const float PATH_SIZE_Y = PATH_END_Y - PATH_START_Y;
-
-const int CROSSTRACK_X = WINDOW_WIDTH * 0.5;
-const int CROSSTRACK_WIDTH = 100;
-
-const float SYNC_REGION0_Y = (WINDOW_HEIGHT / 2) - (TRACK_HEIGHT / 2) - TRACK_THICKNESS;
-const float SYNC_REGION1_Y = (WINDOW_HEIGHT / 2) + (TRACK_HEIGHT / 2);
-
-const float SYNC_REGION_WIDTH = CROSSTRACK_WIDTH;
-const float SYNC_REGION_HEIGHT = TRACK_THICKNESS;
+#include "layout.cpp"
+#include "view.cpp"
+#include "pool.cpp"
+#include "carstore.cpp"
+#include "snapshot.cpp"
+#include "clock.cpp"
+#include "slab.cpp"
+#include "executor.cpp"
+#include "partition.cpp"
+#include "spawner.cpp"
+#include "trace.cpp"
 
 const int FRAMETIME_INFO_PRINT_INTERVAL_MS = 1000;
 
-const float CAR_SPEED_MIN = 0.5f;
-const float CAR_SPEED_MAX = 2.0f;
-
-const int NUM_CARS = 20;
-
-const bool THREAD_UPDATE = true;
+// How the cars are moved:
+// - UPDATE_SINGLE_THREAD: one thread steps all cars once per tick
+// - UPDATE_THREAD_PER_CAR: every car gets its own thread
+// - UPDATE_WORKER_POOL: a fixed pool of threads steps the cars in slices
+// - UPDATE_COROUTINES: every car is a coroutine, all run on one thread
+// - UPDATE_PARTITIONED: the world is cut into strips, one thread each
+enum UpdateMode {
+    UPDATE_SINGLE_THREAD,
+    UPDATE_THREAD_PER_CAR,
+    UPDATE_WORKER_POOL,
+    UPDATE_COROUTINES,
+    UPDATE_PARTITIONED
+};
+
+const UpdateMode UPDATE_MODE = UPDATE_WORKER_POOL;
+
+// Per sync region wait/hold times and counters, written when T is pressed and
+// at exit.
+const char* TELEMETRY_JSON = "telemetry.json";
+const char* TELEMETRY_CSV = "telemetry.csv";
+
+// false runs the simulation as fast as it goes instead of at 120 ticks/s
+const bool REAL_TIME = true;
+
+// Seeds the spawner, so the same cars come in on the same ticks every run.
+// What happens to them still depends on the threads; replay the log with
+// `replay` to rerun the exact spawns.
+const std::optional<uint32_t> SEED = std::nullopt;
+
+// Loops, roads and intersections, see network.cpp. Without the file it's the
+// track from layout.cpp.
+const char* ROADS_CONFIG = "roads.txt";
+
+// How the sync regions pick the next car to let in: "fifo" or "phase", see
+// admission.cpp.
+const char* ADMISSION_POLICY = "fifo";
+
+// Where and how fast cars come in, see spawner.cpp. Without the file it's the
+// traffic of SpawnPlan::standard.
+const char* SPAWN_CONFIG = "spawns.txt";
+
+// Spawns, token grants/releases and exits are recorded and written here at
+// exit.
+const char* EVENTS_LOG = "events.bin";
+
+// Timeline of frames, ticks, token waits and lock holds, see trace.cpp.
+// C starts and stops a capture, which is written here when it stops; with
+// TRACE_AT_START it runs from the start and is written at exit.
+const char* TRACE_JSON = "trace.json";
+const bool TRACE_AT_START = false;
 
 namespace chrono = std::chrono;
 using ms = std::chrono::duration<float, std::milli>;
@@ -53,198 +85,354 @@ int main() {
     sf::Font font;
     font.loadFromFile("/usr/share/fonts/TTF/DejaVuSansMono.ttf");
 
-    sf::RectangleShape track({ TRACK_WIDTH, TRACK_HEIGHT });
-    track.setOrigin(TRACK_WIDTH / 2, TRACK_HEIGHT / 2);
-    track.setPosition(WINDOW_WIDTH / 2, WINDOW_HEIGHT / 2);
-    track.setOutlineThickness(TRACK_THICKNESS);
-    track.setOutlineColor(sf::Color::Blue);
-    track.setFillColor(sf::Color::Transparent);
+    RoadNetwork network;
+    if(!network.load(ROADS_CONFIG)) {
+        std::cout << "using the built in track\n";
+        network = RoadNetwork::standard();
+    }
+    RoadNetworkView networkView(network);
+    Camera camera(network.size, window.getSize());
+
+    SpawnPlan spawnPlan;
+    if(!spawnPlan.load(SPAWN_CONFIG, network)) {
+        std::cout << "using the built in traffic\n";
+        spawnPlan = SpawnPlan::standard(network);
+    }
 
-    sf::RectangleShape crossTrack({CROSSTRACK_WIDTH, WINDOW_HEIGHT});
-    crossTrack.setPosition(CROSSTRACK_X, 0.0);
-    crossTrack.setFillColor(sf::Color(sf::Color::Blue));
+    auto cars = std::make_shared<CarStore>();
+    auto readCarsLock = std::make_shared<std::mutex>();
+    auto carSystem = std::make_shared<CarSystem>(network);
+    carSystem->setAdmissionPolicy(ADMISSION_POLICY);
+    CarSystemView carSystemView(*carSystem, font);
+    CarView carView(font);
 
-    sf::RectangleShape syncRegion0({SYNC_REGION_WIDTH, SYNC_REGION_HEIGHT});
-    syncRegion0.setPosition(CROSSTRACK_X, SYNC_REGION0_Y);
-    syncRegion0.setFillColor(sf::Color::Red);
+    // Whichever mode moves the cars publishes them here after every step, the
+    // render thread draws the newest one without taking any lock.
+    TripleBuffer<Snapshot> snapshots;
 
-    sf::RectangleShape syncRegion1({SYNC_REGION_WIDTH, SYNC_REGION_HEIGHT});
-    syncRegion1.setPosition(CROSSTRACK_X, SYNC_REGION1_Y);
-    syncRegion1.setFillColor(sf::Color::Red);
+    SimClock clock(REAL_TIME);
 
-    auto cars = std::make_shared<std::vector<Car>>();
-    auto readCarsLock = std::make_shared<std::mutex>();
-    auto carSystem = std::shared_ptr<CarSystem>(new CarSystem{
-        {PATH_START_X, PATH_START_Y, PATH_SIZE_X, PATH_SIZE_Y},
-        {CROSSTRACK_X, SYNC_REGION0_Y},
-        {CROSSTRACK_X, SYNC_REGION1_Y},
-        {SYNC_REGION_WIDTH, SYNC_REGION_HEIGHT},
-        {WINDOW_WIDTH, WINDOW_HEIGHT},
-        font
-    });
+    if(TRACE_AT_START) {
+        Tracer::get().start();
+    }
+
+    EventLog events(clock);
+    carSystem->setEventLog(&events);
+
+    std::optional<WorkerPool> workerPool;
+    if(UPDATE_MODE == UPDATE_WORKER_POOL) {
+        workerPool.emplace(*carSystem, clock, snapshots);
+    }
+
+    std::optional<PartitionedEngine> partitioned;
+    if(UPDATE_MODE == UPDATE_PARTITIONED) {
+        partitioned.emplace(*carSystem, clock, snapshots);
+    }
+
+    // How long the last step of the single thread or coroutine loop took, for
+    // the frame time print. The worker pool times its own ticks; with a thread
+    // per car or partitioned there's no one step to time, so it's not printed.
+    std::atomic<float> stepMs = 0.0f;
+
+    std::optional<CarExecutor> executor;
+    std::optional<std::jthread> executorThread;
+    if(UPDATE_MODE == UPDATE_COROUTINES) {
+        executor.emplace(*carSystem);
+        executorThread.emplace([&](std::stop_token stop) {
+            Tracer::get().nameThread("coroutines");
+            while(!stop.stop_requested() && !carSystem->exit) {
+                uint64_t tick = clock.advanceNext();
+                auto stepStart = chrono::steady_clock::now();
+                {
+                    TraceSpan span("tick", "tick", tick);
+                    executor->runTick();
+
+                    Snapshot& snapshot = snapshots.writeBuffer();
+                    snapshot.tick = tick;
+                    snapshot.cars.clear();
+                    executor->forEachCar([&](const Car& car) {
+                        snapshot.cars.push_back({car.position, car.id});
+                    });
+                    snapshot.arrange(network.size);
+                    snapshots.publish();
+                }
+                stepMs = chrono::duration_cast<ms>(chrono::steady_clock::now() - stepStart).count();
+            }
+        });
+    }
 
     auto pause = std::make_shared<std::atomic<bool>>(false);
-    std::vector<std::jthread*> handles;
+
+    std::optional<std::jthread> singleThread;
+    if(UPDATE_MODE == UPDATE_SINGLE_THREAD) {
+        singleThread.emplace([&](std::stop_token stop) {
+            Tracer::get().nameThread("simulation");
+            while(!stop.stop_requested() && !carSystem->exit) {
+                uint64_t tick = clock.advanceNext();
+                auto stepStart = chrono::steady_clock::now();
+                {
+                    TraceSpan span("tick", "tick", tick);
+                    TracedLock lock(*readCarsLock, "wait readCarsLock", "hold readCarsLock");
+                    cars->step(*carSystem);
+                    Snapshot& snapshot = snapshots.writeBuffer();
+                    snapshot.tick = tick;
+                    cars->snapshot(snapshot);
+                    snapshot.arrange(network.size);
+                    snapshots.publish();
+                }
+                stepMs = chrono::duration_cast<ms>(chrono::steady_clock::now() - stepStart).count();
+            }
+        });
+    }
 
     auto threadedCarsLock = std::make_shared<std::mutex>();
-    std::vector<std::shared_ptr<Car>> threadedCars;
-
-    auto spawnTrack = new std::jthread([&, readCarsLock, cars, pause] {
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_int_distribution<int> car_offset_dist(-TRACK_THICKNESS / 4, TRACK_THICKNESS / 4);
-        std::uniform_real_distribution<float> speed_dist(CAR_SPEED_MIN, CAR_SPEED_MAX);
-        std::uniform_int_distribution<int> nextSpawnTimeMsDist(100, 1000);
-
-        for(int i = 0; i < NUM_CARS; !*pause ? ++i : i) {
-            auto nextSpawnTimeMs = nextSpawnTimeMsDist(gen);
-            std::this_thread::sleep_for(chrono::milliseconds(nextSpawnTimeMs));
-            if(*pause) continue;
-
-            float x = car_offset_dist(gen);
-            float y = car_offset_dist(gen);
-            float speed = speed_dist(gen);
-
-            if(!THREAD_UPDATE) {
-                readCarsLock->lock();
-                auto& c = cars->emplace_back(Car::spawnTrack({PATH_START_X, PATH_START_Y}, {x, y}, speed, font));
-                readCarsLock->unlock();
-            } else {
-                handles.emplace_back(new std::jthread([&](){
-                    auto c = std::make_shared<Car>(Car::spawnTrack({PATH_START_X, PATH_START_Y}, {x, y}, speed, font));
-                    threadedCarsLock->lock();
-                    threadedCars.push_back(c);
-                    threadedCarsLock->unlock();
-                    carSystem->updateCarSync(*c);
-                }));
+    SlabPool<ThreadedCar> threadedCars;
+
+    // Every car gets a slot in threadedCars with its thread in it. The
+    // thread only drives the car; the spawn thread joins it and frees the slot
+    // once the car left the screen, and every car still driving is stopped
+    // and joined at exit.
+    auto startThreaded = [&](const Car& car) {
+        TracedLock lock(*threadedCarsLock, "wait threadedCarsLock", "hold threadedCarsLock");
+        ThreadedCar* c = &threadedCars.get(threadedCars.create(car));
+        c->thread = std::jthread([&, c](std::stop_token stop) {
+            Tracer::get().nameThread("car");
+            carSystem->updateCarSync(c->car, clock, &c->published, stop);
+            c->finished = true;
+        });
+    };
+    auto joinThreaded = [&](bool all) {
+        TracedLock lock(*threadedCarsLock, "wait threadedCarsLock", "hold threadedCarsLock");
+        threadedCars.destroyIf([&](ThreadedCar& c) { return all || c.finished; });
+    };
+
+    // Car threads only publish their own position, this one gathers them.
+    std::optional<std::jthread> clockThread;
+    std::optional<std::jthread> threadedSnapshots;
+    if(UPDATE_MODE == UPDATE_THREAD_PER_CAR) {
+        clockThread.emplace([&](std::stop_token stop) {
+            while(!stop.stop_requested() && !carSystem->exit) {
+                clock.advanceNext();
             }
-        
-            if(carSystem->exit) {
-                return;
+        });
+        threadedSnapshots.emplace([&](std::stop_token stop) {
+            Tracer::get().nameThread("snapshots");
+            uint64_t tick = 0;
+            while(!stop.stop_requested() && !carSystem->exit) {
+                tick = clock.waitFor(tick + 1);
+
+                Snapshot& snapshot = snapshots.writeBuffer();
+                snapshot.tick = tick;
+                snapshot.cars.clear();
+                {
+                    TracedLock lock(*threadedCarsLock, "wait threadedCarsLock", "hold threadedCarsLock");
+                    threadedCars.forEach([&](ThreadedCar& c) {
+                        if(!c.finished) {
+                            snapshot.cars.push_back({c.published.load(std::memory_order_relaxed), c.car.id});
+                        }
+                    });
+                }
+                snapshot.arrange(network.size);
+                snapshots.publish();
+            }
+        });
+    }
+
+    // One thread spawns all the cars: every tick it draws the cars arriving
+    // on it from the plan and hands them to the update mode in one batch.
+    std::optional<std::jthread> spawnThread;
+    spawnThread.emplace([&](std::stop_token stop) {
+        Tracer::get().nameThread("spawner");
+        Spawner spawner(network, spawnPlan, SEED ? *SEED : std::random_device()());
+        std::vector<Car> batch;
+        uint64_t tick = clock.now();
+        while(!stop.stop_requested() && !carSystem->exit) {
+            uint64_t now = clock.waitFor(tick + 1);
+            batch.clear();
+            for(; tick < now; ++tick) {
+                if(!*pause) {
+                    spawner.spawnDue(carSystem->joined - carSystem->exited, batch);
+                }
+            }
+            if(UPDATE_MODE == UPDATE_THREAD_PER_CAR) {
+                joinThreaded(false);
+            }
+            if(batch.empty() || carSystem->exit) {
+                continue;
             }
-        }
-        std::cout << "spawn thread exiting!" << std::endl;
-    });
 
-    auto spawnCrosstrack = new std::jthread([&, readCarsLock, cars, pause] {
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_int_distribution<int> car_offset_dist(-TRACK_THICKNESS / 4, TRACK_THICKNESS / 4);
-        std::uniform_real_distribution<float> speed_dist(CAR_SPEED_MIN, CAR_SPEED_MAX);
-        std::uniform_int_distribution<int> nextSpawnTimeMsDist(100, 1000);
-
-        while(!carSystem->exit) {
-            auto nextSpawnTimeMs = nextSpawnTimeMsDist(gen);
-            std::this_thread::sleep_for(chrono::milliseconds(nextSpawnTimeMs));
-            if(*pause) continue;
-
-            float x = car_offset_dist(gen);
-            float y = car_offset_dist(gen);
-            float speed = speed_dist(gen);
-
-            if(!THREAD_UPDATE) {
-                readCarsLock->lock();
-                auto& c = cars->emplace_back(Car::spawnCross({CROSSTRACK_X + (CROSSTRACK_WIDTH / 2), 0}, {x, y}, speed, font));
-                readCarsLock->unlock();
+            // the car stores count a car as joined once its spot is free, the
+            // coroutines and the car threads start their cars right away
+            TraceSpan span("spawn", "cars", batch.size());
+            if(UPDATE_MODE == UPDATE_SINGLE_THREAD) {
+                TracedLock lock(*readCarsLock, "wait readCarsLock", "hold readCarsLock");
+                for(auto& car: batch) {
+                    cars->spawn(car);
+                }
             } else {
-                handles.emplace_back(new std::jthread([&](){
-                    auto c = std::make_shared<Car>(Car::spawnCross({CROSSTRACK_X + (CROSSTRACK_WIDTH / 2), 0}, {x, y}, speed, font));
-
-                    threadedCarsLock->lock();
-                    threadedCars.end();
-                    threadedCars.push_back(c);
-                    threadedCarsLock->unlock();
-
-                    carSystem->updateCarSync(*c);
-
-                    threadedCarsLock->lock();
-                    auto pos = std::find(threadedCars.begin(), threadedCars.end(), c);
-                    if(pos != threadedCars.end())
-                        threadedCars.erase(pos);
-                    threadedCarsLock->unlock();
-                }));
+                for(auto& car: batch) {
+                    if(UPDATE_MODE == UPDATE_WORKER_POOL) {
+                        workerPool->add(car);
+                    } else if(UPDATE_MODE == UPDATE_PARTITIONED) {
+                        partitioned->add(car);
+                    } else if(UPDATE_MODE == UPDATE_COROUTINES) {
+                        carSystem->join(car);
+                        executor->spawn(car);
+                    } else {
+                        carSystem->join(car);
+                        startThreaded(car);
+                    }
+                }
             }
         }
-        std::cout << "exiting spawn thread!" << std::endl;
+        uint64_t turnedAway = 0;
+        if(UPDATE_MODE == UPDATE_SINGLE_THREAD) {
+            TracedLock lock(*readCarsLock, "wait readCarsLock", "hold readCarsLock");
+            turnedAway = cars->turnedAway();
+        } else if(UPDATE_MODE == UPDATE_WORKER_POOL) {
+            turnedAway = workerPool->turnedAway();
+        } else if(UPDATE_MODE == UPDATE_PARTITIONED) {
+            turnedAway = partitioned->turnedAway();
+        }
+        std::cout << "spawn thread exiting, " << carSystem->joined << " cars spawned, "
+            << spawner.throttled() + turnedAway << " throttled" << std::endl;
     });
 
-    auto programStartTimeMs = chrono::steady_clock::now();
-    auto lastFrametimePrint = programStartTimeMs;
-    uint32_t numFrame = 0;
-
-    while (window.isOpen()) {
-        auto currentTime = chrono::steady_clock::now();
-
-        sf::Event event;
-        while (window.pollEvent(event))
-        {
-            if (event.type == sf::Event::Closed) {
-                carSystem->shutdown();
-                window.close();
+    // Draws on its own thread, so a slow frame doesn't hold up the ticks and
+    // the cars don't jump when the ticks don't line up with the frames. While
+    // paused it sleeps until unpaused.
+    window.setActive(false);
+    std::jthread renderThread([&](std::stop_token stop) {
+        Tracer::get().nameThread("render");
+        window.setActive(true);
+        SnapshotInterpolator interpolator;
+        std::vector<CarSnapshot> frameCars;
+
+        auto lastFrametimePrint = chrono::steady_clock::now();
+        uint32_t numFrame = 0;
+
+        while(!stop.stop_requested()) {
+            if(*pause) {
+                pause->wait(true);
+                lastFrametimePrint = chrono::steady_clock::now();
+                continue;
             }
-
-            if(event.type == sf::Event::KeyPressed) {
-                if(event.key.code == sf::Keyboard::P) {
-                    *pause = !*pause;
-                    lastFrametimePrint = programStartTimeMs;
+            ++numFrame;
+            TraceSpan frameSpan("frame", "frame", numFrame);
+
+            auto currentTime = chrono::steady_clock::now();
+            TraceSpan interpolateSpan("interpolate");
+            interpolator.update(snapshots.read(), currentTime);
+            Rect visible = camera.visible();
+            float scale = camera.pixelScale();
+            interpolator.at(currentTime, visible, frameCars);
+            interpolateSpan.end();
+
+            // draw
+            auto frametimeDrawStart = chrono::steady_clock::now();
+            TraceSpan drawSpan("draw", "cars", frameCars.size());
+
+            window.clear();
+            window.setView(camera.view());
+            networkView.draw(window, visible);
+
+            carSystemView.draw(window, *carSystem, visible, scale);
+
+            carView.draw(window, frameCars, visible, scale);
+
+            drawSpan.end();
+            auto frametimeDrawEnd = chrono::steady_clock::now();
+
+            TraceSpan displaySpan("display");
+            window.display();
+            displaySpan.end();
+
+            float frametimeDraw = chrono::duration_cast<ms>(frametimeDrawEnd - frametimeDrawStart).count();
+            float frametimeFull = chrono::duration_cast<ms>(chrono::steady_clock::now() - currentTime).count();
+
+            if(chrono::duration_cast<ms>(currentTime - lastFrametimePrint).count() > FRAMETIME_INFO_PRINT_INTERVAL_MS) {
+                std::cout.precision(3);
+                std::cout << '[' << numFrame << ']' << "   ";
+                if(UPDATE_MODE == UPDATE_WORKER_POOL) {
+                    std::cout << "simulation: " << std::fixed << std::setw(5) << workerPool->lastStepMs() << " ms   ";
+                } else if(UPDATE_MODE != UPDATE_THREAD_PER_CAR && UPDATE_MODE != UPDATE_PARTITIONED) {
+                    std::cout << "simulation: " << std::fixed << std::setw(5) << stepMs.load() << " ms   ";
                 }
+                std::cout << "draw: " << std::fixed << std::setw(5) << frametimeDraw << " ms   ";
+                std::cout << "frame: " << std::fixed << std::setw(5) << frametimeFull << " ms   \n";
+
+                lastFrametimePrint = currentTime;
             }
         }
+        window.setActive(false);
+    });
 
-        if(*pause) continue;
-        ++numFrame;
-
-        readCarsLock->lock();
-
-        // update
-        auto frametimeUpdateStart = chrono::steady_clock::now();
-        if(!THREAD_UPDATE) carSystem->update(*cars);
-        auto frametimeUpdateEnd = chrono::steady_clock::now();
-
-        // draw
-        auto frametimeDrawStart = chrono::steady_clock::now();
-
-        window.clear();
-        window.draw(track);
-        window.draw(crossTrack);
-        window.draw(syncRegion0);
-        window.draw(syncRegion1);
-
-        carSystem->draw(window);
+    auto stopRendering = [&] {
+        if(renderThread.joinable()) {
+            renderThread.request_stop();
+            *pause = false;
+            pause->notify_all();
+            renderThread.join();
+        }
+    };
+
+    Tracer::get().nameThread("events");
+
+    // This thread only handles events, it sleeps until there is one. The
+    // wheel zooms at the cursor, the arrows or dragging with the right button
+    // move the camera, R shows the whole world again.
+    std::optional<sf::Vector2i> dragFrom;
+    sf::Event event;
+    while(window.isOpen() && window.waitEvent(event)) {
+        if (event.type == sf::Event::Closed) {
+            carSystem->shutdown();
+            clock.stop();
+
+            stopRendering();
+            window.setActive(true);
+            window.close();
+        }
 
-        if(!THREAD_UPDATE) {
-            for(auto& car: *cars) {
-                window.draw(car.shape);
-                window.draw(car.label);
+        if(event.type == sf::Event::KeyPressed) {
+            if(event.key.code == sf::Keyboard::P) {
+                *pause = !*pause;
+                pause->notify_all();
             }
-        } else {
-            threadedCarsLock->lock();
-            for(auto& car: threadedCars) {
-                window.draw(car->shape);
-                window.draw(car->label);
+            if(event.key.code == sf::Keyboard::T) {
+                carSystem->writeTelemetry(TELEMETRY_JSON);
+                carSystem->writeTelemetry(TELEMETRY_CSV);
+            }
+            if(event.key.code == sf::Keyboard::C) {
+                if(Tracer::get().enabled()) {
+                    Tracer::get().stop();
+                    Tracer::get().write(TRACE_JSON);
+                } else {
+                    std::cout << "tracing, C again to stop\n";
+                    Tracer::get().start();
+                }
             }
-            threadedCarsLock->unlock();
         }
 
-        auto frametimeDrawEnd = chrono::steady_clock::now();
-
-        readCarsLock->unlock();
-
-        window.display();
-
-        float frametimeDraw = chrono::duration_cast<ms>(frametimeDrawEnd - frametimeDrawStart).count();
-        float frametimeUpdate = chrono::duration_cast<ms>(frametimeUpdateEnd - frametimeUpdateStart).count();
-        float frametimeFull = chrono::duration_cast<ms>(chrono::steady_clock::now() - currentTime).count();
-
-        if(chrono::duration_cast<ms>(currentTime - lastFrametimePrint).count() > FRAMETIME_INFO_PRINT_INTERVAL_MS) {
-            std::cout.precision(3);
-            std::cout << '[' << numFrame << ']' << "   ";
-            std::cout << "simulation: " << std::fixed << std::setw(5) << frametimeUpdate << " ms   ";
-            std::cout << "draw: " << std::fixed << std::setw(5) << frametimeDraw << " ms   ";
-            std::cout << "frame: " << std::fixed << std::setw(5) << frametimeFull << " ms   \n";
-
-            lastFrametimePrint = currentTime;
-        }
+        handleCameraEvent(camera, event, dragFrom);
+    }
+    stopRendering();
+
+    carSystem->writeTelemetry(TELEMETRY_JSON);
+    carSystem->writeTelemetry(TELEMETRY_CSV);
+
+    // stop the threads that record before reading the log
+    spawnThread.reset();
+    joinThreaded(true);
+    singleThread.reset();
+    workerPool.reset();
+    partitioned.reset();
+    threadedSnapshots.reset();
+    clockThread.reset();
+    executorThread.reset();
+    events.write(EVENTS_LOG);
+    if(Tracer::get().enabled()) {
+        Tracer::get().stop();
+        Tracer::get().write(TRACE_JSON);
     }
 
     return 0;
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "car.cpp"
+#include "layout.cpp"
+#include "spatial.cpp"
+
+// A loop is a rectangular road the track cars drive around clockwise; `path`
+// is the line they follow, the road is `thickness` wide around it.
+struct Loop {
+    Rect path;
+};
+
+// A straight road from the top of the world to the bottom, the crosstrack
+// cars drive down the middle of it.
+struct Road {
+    float left;
+    float width;
+};
+
+// Where a road crosses the top or bottom side of a loop. Every intersection
+// gets its own sync region.
+struct Intersection {
+    Rect box;
+    uint32_t loop;
+    uint32_t road;
+};
+
+// One straight piece of a Route, starting `distance` along it.
+struct Segment {
+    Vec2 start;
+    Vec2 dir;
+    float distance;
+    float length;
+    // what the sync regions see a car on this segment as
+    CarMoveState state;
+
+    Vec2 pointAt(float routeDistance) const {
+        float along = routeDistance - distance;
+        return {start.x + dir.x * along, start.y + dir.y * along};
+    }
+};
+
+// The line cars follow, made into segments once when the network is built.
+// A car on a route only needs how far along it is: a closed route goes
+// around, so the distance wraps at `length`, an open one goes on along its
+// last segment for as long as the car drives.
+struct Route {
+    std::vector<Segment> segments;
+    float length = 0.0f;
+    bool closed = false;
+
+    Route() = default;
+
+    // Through `points` in order, back to the first one if `closed`. Cars on
+    // a `crossing` route are MOVE_STRAIGHT_DOWN, on others it's the state
+    // closest to the direction of the segment.
+    Route(const std::vector<Vec2>& points, bool closed, bool crossing = false): closed(closed) {
+        size_t n = points.size();
+        for(size_t i = 0; i + 1 < n + closed; ++i) {
+            Vec2 d = points[(i + 1) % n] - points[i];
+            float segmentLength = std::hypot(d.x, d.y);
+            if(segmentLength <= 0.0f) {
+                continue;
+            }
+            Vec2 dir{d.x / segmentLength, d.y / segmentLength};
+            CarMoveState state = crossing ? MOVE_STRAIGHT_DOWN
+                : std::abs(dir.x) >= std::abs(dir.y) ? (dir.x > 0.0f ? MOVE_RIGHT : MOVE_LEFT)
+                : (dir.y > 0.0f ? MOVE_DOWN : MOVE_UP);
+            segments.push_back({points[i], dir, length, segmentLength, state});
+            length += segmentLength;
+        }
+        if(segments.empty()) {
+            // a car on it just stays where it is
+            segments.push_back({n ? points[0] : Vec2{}, {}, 0.0f, 0.0f, crossing ? MOVE_STRAIGHT_DOWN : MOVE_RIGHT});
+            this->closed = false;
+        }
+    }
+
+    // `distance` moved on by `by`.
+    float advance(float distance, float by) const {
+        distance += by;
+        if(closed && distance >= length) {
+            distance = std::fmod(distance, length);
+        }
+        return distance;
+    }
+
+    // Index of the segment `distance` is on.
+    size_t segmentAt(float distance) const {
+        // routes are a few segments long, a scan beats a binary search
+        size_t i = segments.size() - 1;
+        while(i > 0 && distance < segments[i].distance) {
+            --i;
+        }
+        return i;
+    }
+
+    // Distance at which segment `i` ends, infinity for the one an open route
+    // ends with.
+    float segmentEnd(size_t i) const {
+        if(!closed && i + 1 == segments.size()) {
+            return std::numeric_limits<float>::infinity();
+        }
+        return segments[i].distance + segments[i].length;
+    }
+};
+
+// The roads of the simulation and where they cross, read from a config file
+// (see roads.txt) or made from layout.cpp. Lines are:
+//
+//   window <width> <height>       size of the world, cars leave at the bottom
+//   thickness <t>                 how wide every road is, below 512
+//   loop <left> <top> <width> <height>
+//   grid <cols> <rows> <left> <top> <width> <height> <spacing>
+//                                 cols x rows loops, `spacing` apart
+//   road <left> <width>
+//   roads <count> <left> <width> <spacing>
+//
+// Anything after a # is a comment.
+struct RoadNetwork {
+    Vec2 size{float(WINDOW_WIDTH), float(WINDOW_HEIGHT)};
+    float thickness = TRACK_THICKNESS;
+    std::vector<Loop> loops;
+    std::vector<Road> roads;
+    std::vector<Intersection> intersections;
+    // the loops clockwise from their top left corner, then the roads from
+    // top to bottom
+    std::vector<Route> routes;
+
+    // The track and crosstrack from layout.cpp.
+    static RoadNetwork standard() {
+        RoadNetwork network;
+        network.loops.push_back({{PATH_START_X, PATH_START_Y, PATH_SIZE_X, PATH_SIZE_Y}});
+        network.roads.push_back({float(CROSSTRACK_X), float(CROSSTRACK_WIDTH)});
+        network.build();
+        return network;
+    }
+
+    // Replaces this network with the one in the file. Prints what's wrong
+    // and returns false if the file can't be read.
+    bool load(const std::string& path) {
+        std::ifstream in(path);
+        if(!in) {
+            std::cerr << "can't open " << path << "\n";
+            return false;
+        }
+
+        RoadNetwork network;
+        std::string line;
+        for(int lineNumber = 1; std::getline(in, line); ++lineNumber) {
+            std::istringstream words(line.substr(0, line.find('#')));
+            std::string keyword;
+            if(!(words >> keyword)) {
+                continue;
+            }
+
+            bool ok = true;
+            if(keyword == "window") {
+                ok = bool(words >> network.size.x >> network.size.y);
+            } else if(keyword == "thickness") {
+                ok = bool(words >> network.thickness);
+                // cars spawn up to thickness / 4 off the middle of the road
+                // and the event log keeps that offset in an int8_t
+                if(ok && int(network.thickness / 4) > std::numeric_limits<int8_t>::max()) {
+                    std::cerr << path << ":" << lineNumber << ": thickness has to be below "
+                        << 4 * (std::numeric_limits<int8_t>::max() + 1) << "\n";
+                    return false;
+                }
+            } else if(keyword == "loop") {
+                Rect path;
+                ok = bool(words >> path.left >> path.top >> path.width >> path.height);
+                network.loops.push_back({path});
+            } else if(keyword == "grid") {
+                int cols, rows;
+                Rect path;
+                float spacing;
+                ok = bool(words >> cols >> rows >> path.left >> path.top >> path.width >> path.height >> spacing);
+                for(int row = 0; ok && row < rows; ++row) {
+                    for(int col = 0; col < cols; ++col) {
+                        network.loops.push_back({{path.left + col * (path.width + spacing),
+                            path.top + row * (path.height + spacing), path.width, path.height}});
+                    }
+                }
+            } else if(keyword == "road") {
+                Road road;
+                ok = bool(words >> road.left >> road.width);
+                network.roads.push_back(road);
+            } else if(keyword == "roads") {
+                int count;
+                Road road;
+                float spacing;
+                ok = bool(words >> count >> road.left >> road.width >> spacing);
+                for(int i = 0; ok && i < count; ++i) {
+                    network.roads.push_back({road.left + i * (road.width + spacing), road.width});
+                }
+            } else {
+                std::cerr << path << ":" << lineNumber << ": unknown keyword " << keyword << "\n";
+                return false;
+            }
+            if(!ok) {
+                std::cerr << path << ":" << lineNumber << ": bad " << keyword << " line\n";
+                return false;
+            }
+        }
+        if(network.loops.empty() && network.roads.empty()) {
+            std::cerr << path << ": no loops or roads\n";
+            return false;
+        }
+
+        network.build();
+        *this = std::move(network);
+        return true;
+    }
+
+    // Makes the routes, finds where the roads cross the loops and indexes the
+    // intersections.
+    void build() {
+        routes.clear();
+        for(auto& loop: loops) {
+            const Rect& p = loop.path;
+            routes.emplace_back(std::vector<Vec2>{{p.left, p.top}, {p.left + p.width, p.top},
+                {p.left + p.width, p.top + p.height}, {p.left, p.top + p.height}}, true);
+        }
+        for(uint32_t r = 0; r < roads.size(); ++r) {
+            Vec2 start = roadStart(r);
+            routes.emplace_back(std::vector<Vec2>{start, {start.x, size.y}}, false, true);
+        }
+
+        intersections.clear();
+        for(uint32_t r = 0; r < roads.size(); ++r) {
+            const Road& road = roads[r];
+            for(uint32_t l = 0; l < loops.size(); ++l) {
+                const Rect& path = loops[l].path;
+                if(road.left + road.width <= path.left || road.left >= path.left + path.width) {
+                    continue;
+                }
+                for(float y: {path.top, path.top + path.height}) {
+                    intersections.push_back({{road.left, y - thickness / 2, road.width, thickness}, l, r});
+                }
+            }
+        }
+
+        std::vector<Rect> boxes;
+        for(auto& intersection: intersections) {
+            boxes.push_back(intersection.box);
+        }
+        index.build(boxes, thickness);
+    }
+
+    // Intersection containing `p`, -1 if it's not in any.
+    int32_t intersectionAt(const Vec2& p) const {
+        return index.find(p);
+    }
+
+    // Calls f(index) for every intersection overlapping `rect`.
+    template <typename F>
+    void forEachIntersectionIn(const Rect& rect, F f) const {
+        index.forEachInRect(rect, f);
+    }
+
+    // Every intersection is inside this box.
+    Rect intersectionBounds() const {
+        return index.bounds();
+    }
+
+    // The route `car` drives along, its position is on it moved by its offset.
+    const Route& routeOf(const Car& car) const {
+        return routes[car.state == MOVE_STRAIGHT_DOWN ? loops.size() + car.road : car.road];
+    }
+
+    // Where the cars of a loop or a road come in, at distance 0 on their route.
+    Vec2 loopStart(uint32_t loop) const {
+        return {loops[loop].path.left, loops[loop].path.top};
+    }
+
+    Vec2 roadStart(uint32_t road) const {
+        return {roads[road].left + roads[road].width / 2, 0.0f};
+    }
+
+private:
+    RectIndex index;
+};
@@ -0,0 +1,294 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "carstore.cpp"
+#include "clock.cpp"
+#include "snapshot.cpp"
+#include "spsc.cpp"
+#include "trace.cpp"
+
+// The world cut into vertical strips, one per worker. Each worker owns the
+// cars in its strip in a CarStore of its own and steps them on its own
+// schedule, so the workers don't share any car data and don't wait for each
+// other every tick like the WorkerPool does:
+// - a worker may get at most one tick ahead of the strips next to it, that's
+//   all the synchronization between them
+// - a car that drives into the next strip is handed over through a bounded
+//   SpscQueue; if the queue is full it stays where it is, still stepped by
+//   its old worker, and tries again next tick
+// - a sync region is only ever locked by two workers when its intersection
+//   sits on the edge between two strips (see edgeIntersections), for the
+//   rest its mutex is only taken by one thread
+//
+// Cars only follow and wait for cars in their own strip, a car right behind
+// the edge doesn't see the one right in front of it.
+class PartitionedEngine {
+public:
+    // How many cars can be on their way from one strip to the next at once.
+    static const size_t HANDOVER_CAPACITY = 1024;
+    // How far ahead of the slowest strip the clock is allowed to get.
+    static const uint64_t MAX_LAG = 4;
+
+    // Without publishSnapshots nothing is written to `snapshots`, e.g. for
+    // benchmarks.
+    PartitionedEngine(CarSystem& carSystem, SimClock& clock, TripleBuffer<Snapshot>& snapshots,
+        size_t numWorkers = std::max(1u, std::thread::hardware_concurrency()),
+        bool carFollowing = true, bool publishSnapshots = true)
+        : carSystem(carSystem), clock(clock), snapshots(snapshots), publishSnapshots(publishSnapshots) {
+        // a strip has to be wider than a car can move in one tick, so cars
+        // only ever go to the strip next door
+        float width = carSystem.network.size.x;
+        numWorkers = std::clamp(size_t(width / (2 * CAR_SPEED_MAX)), size_t(1), numWorkers);
+        stripWidth = width / numWorkers;
+
+        for(size_t i = 0; i < numWorkers; ++i) {
+            partitions.emplace_back().cars.carFollowing = carFollowing;
+        }
+        for(size_t i = 0; i < numWorkers; ++i) {
+            workers.emplace_back([this, i] { work(i); });
+        }
+        coordinator = std::jthread([this](std::stop_token stop) { coordinate(stop); });
+    }
+
+    ~PartitionedEngine() {
+        stop();
+    }
+
+    void stop() {
+        if(coordinator.joinable()) {
+            coordinator.request_stop();
+            coordinator.join();
+        }
+        workers.clear();
+    }
+
+    // Can be called from any thread, the car goes to the strip it's in.
+    void add(const Car& car) {
+        Partition& partition = partitions[stripOf(car.position.x)];
+        std::unique_lock lock(partition.spawnedMutex);
+        partition.spawned.push_back(car);
+    }
+
+    size_t size() const {
+        size_t n = 0;
+        for(auto& partition: partitions) {
+            n += partition.alive.load(std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+    // Cars that found their spawn point full, in any strip.
+    uint64_t turnedAway() const {
+        uint64_t n = 0;
+        for(auto& partition: partitions) {
+            n += partition.turnedAway.load(std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+    size_t numPartitions() const {
+        return partitions.size();
+    }
+
+    // Last tick every strip is done with.
+    uint64_t completed() const {
+        uint64_t tick = std::numeric_limits<uint64_t>::max();
+        for(auto& partition: partitions) {
+            tick = std::min(tick, partition.done.load(std::memory_order_acquire));
+        }
+        return tick;
+    }
+
+    // Intersections shared by two strips, the only sync regions more than one
+    // worker asks for tokens.
+    size_t edgeIntersections() const {
+        size_t n = 0;
+        for(auto& intersection: carSystem.network.intersections) {
+            const Rect& box = intersection.box;
+            n += stripOf(box.left) != stripOf(box.left + box.width);
+        }
+        return n;
+    }
+
+private:
+    // A car on its way to another strip, with the last tick it was stepped
+    // on, so it isn't stepped twice on the same tick.
+    struct Handover {
+        Car car;
+        uint64_t tick;
+    };
+
+    struct Partition {
+        CarStore cars;
+        std::vector<Handover> arrived;
+
+        std::mutex spawnedMutex;
+        std::vector<Car> spawned;
+
+        // from the strips on the left and on the right
+        SpscQueue<Handover> fromLeft{HANDOVER_CAPACITY};
+        SpscQueue<Handover> fromRight{HANDOVER_CAPACITY};
+
+        TripleBuffer<Snapshot> snapshots;
+
+        alignas(64) std::atomic<uint64_t> done = 0;
+        std::atomic<size_t> alive = 0;
+        std::atomic<uint64_t> turnedAway = 0;
+    };
+
+    CarSystem& carSystem;
+    SimClock& clock;
+    TripleBuffer<Snapshot>& snapshots;
+    const bool publishSnapshots;
+
+    float stripWidth;
+    // deque, because a Partition can't be moved
+    std::deque<Partition> partitions;
+
+    // the workers step up to this tick
+    alignas(64) std::atomic<uint64_t> target = 0;
+    std::atomic<bool> stopping = false;
+
+    std::vector<std::jthread> workers;
+    std::jthread coordinator;
+
+    size_t stripOf(float x) const {
+        return std::clamp<int64_t>(int64_t(x / stripWidth), 0, partitions.size() - 1);
+    }
+
+    // Drives the clock and merges the strips into one snapshot.
+    void coordinate(std::stop_token stop) {
+        Tracer::get().nameThread("partition coordinator");
+        while(!stop.stop_requested() && !carSystem.exit) {
+            uint64_t tick = clock.advanceNext();
+            TraceSpan span("tick", "tick", tick);
+            for(auto& partition: partitions) {
+                for(uint64_t done = partition.done.load(std::memory_order_acquire);
+                    done + MAX_LAG < tick && !stop.stop_requested();
+                    done = partition.done.load(std::memory_order_acquire)) {
+                    partition.done.wait(done, std::memory_order_acquire);
+                }
+            }
+            target.store(tick, std::memory_order_release);
+            target.notify_all();
+
+            if(publishSnapshots) {
+                Snapshot& snapshot = snapshots.writeBuffer();
+                snapshot.tick = completed();
+                snapshot.cars.clear();
+                for(auto& partition: partitions) {
+                    auto& cars = partition.snapshots.read().cars;
+                    snapshot.cars.insert(snapshot.cars.end(), cars.begin(), cars.end());
+                }
+                snapshot.arrange(carSystem.network.size);
+                snapshots.publish();
+            }
+        }
+
+        stopping = true;
+        target.store(std::numeric_limits<uint64_t>::max(), std::memory_order_release);
+        target.notify_all();
+    }
+
+    void work(size_t index) {
+        Tracer::get().nameThread("partition");
+        Partition& partition = partitions[index];
+        uint64_t tick = 0;
+        while(!stopping) {
+            uint64_t goal = target.load(std::memory_order_acquire);
+            if(goal <= tick) {
+                target.wait(goal, std::memory_order_acquire);
+                continue;
+            }
+            for(; tick < goal && !stopping && waitForNeighbours(index, tick + 1); ++tick) {
+                TraceSpan span("step", "tick", tick + 1);
+                step(index, tick + 1);
+                partition.alive.store(partition.cars.size(), std::memory_order_relaxed);
+                partition.turnedAway.store(partition.cars.turnedAway(), std::memory_order_relaxed);
+                partition.done.store(tick + 1, std::memory_order_release);
+                partition.done.notify_all();
+            }
+
+            if(publishSnapshots) {
+                Snapshot& snapshot = partition.snapshots.writeBuffer();
+                snapshot.tick = tick;
+                partition.cars.snapshot(snapshot);
+                partition.snapshots.publish();
+            }
+        }
+
+        // nobody waits for this strip anymore
+        partition.done.store(std::numeric_limits<uint64_t>::max(), std::memory_order_release);
+        partition.done.notify_all();
+    }
+
+    // Waits until the strips next door are done with the tick before `tick`.
+    // Returns false when stopping.
+    bool waitForNeighbours(size_t index, uint64_t tick) {
+        for(size_t n: {index - 1, index + 1}) {
+            if(n >= partitions.size()) {
+                continue;
+            }
+            auto& done = partitions[n].done;
+            for(uint64_t d = done.load(std::memory_order_acquire); d + 1 < tick;
+                d = done.load(std::memory_order_acquire)) {
+                if(stopping) {
+                    return false;
+                }
+                done.wait(d, std::memory_order_acquire);
+            }
+        }
+        return !stopping;
+    }
+
+    void step(size_t index, uint64_t tick) {
+        Partition& partition = partitions[index];
+        CarStore& cars = partition.cars;
+
+        // A neighbour may already be done with this tick, then the cars it
+        // handed over just now wait for the next one.
+        Handover handover{Car::restore(0, {}, 0.0f), 0};
+        while(partition.fromLeft.tryPop(handover) || partition.fromRight.tryPop(handover)) {
+            partition.arrived.push_back(handover);
+        }
+        size_t kept = 0;
+        for(auto& h: partition.arrived) {
+            if(h.tick < tick) {
+                cars.add(h.car, carSystem);
+            } else {
+                partition.arrived[kept++] = h;
+            }
+        }
+        partition.arrived.erase(partition.arrived.begin() + kept, partition.arrived.end());
+
+        {
+            std::unique_lock lock(partition.spawnedMutex);
+            for(auto& car: partition.spawned) {
+                cars.spawn(car);
+            }
+            partition.spawned.clear();
+        }
+
+        cars.step(carSystem);
+
+        for(size_t i = cars.size(); i-- > 0;) {
+            size_t strip = stripOf(cars.x[i]);
+            if(strip == index) {
+                continue;
+            }
+            Partition& next = partitions[strip < index ? index - 1 : index + 1];
+            auto& queue = strip < index ? next.fromRight : next.fromLeft;
+            if(queue.tryPush({cars.get(i), tick})) {
+                cars.remove(i);
+            }
+        }
+    }
+};
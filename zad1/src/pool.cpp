@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <barrier>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cars.cpp"
+#include "clock.cpp"
+#include "snapshot.cpp"
+#include "spatial.cpp"
+#include "spawner.cpp"
+#include "trace.cpp"
+
+// Fixed number of threads stepping all the cars, instead of one thread per
+// car. Every tick of the clock the cars are split into one slice per worker and each
+// worker advances its slice, then the result is published to `snapshots`
+// for the renderer. Cars waiting for a token don't block their
+// worker, they are parked (see Car::parkedOn) and skipped until a release.
+//
+// With carFollowing a tick has two phases: first every worker works out how
+// far its cars may go (followDistance), reading positions from before the
+// tick, then after all of them are done they move the cars.
+class WorkerPool {
+public:
+    WorkerPool(CarSystem& carSystem, SimClock& clock, TripleBuffer<Snapshot>& snapshots,
+        size_t numWorkers = std::max(1u, std::thread::hardware_concurrency()), bool carFollowing = true)
+        : carSystem(carSystem), clock(clock), snapshots(snapshots), numWorkers(numWorkers), carFollowing(carFollowing),
+          tickBarrier(numWorkers), followBarrier(numWorkers), doneBarrier(numWorkers) {
+        // worker 0 is the one driving the clock
+        workers.emplace_back([this](std::stop_token stop) { coordinate(stop); });
+        for(size_t i = 1; i < numWorkers; ++i) {
+            workers.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    ~WorkerPool() {
+        stop();
+    }
+
+    void stop() {
+        if(!workers.empty()) {
+            workers.front().request_stop();
+        }
+        workers.clear();
+    }
+
+    // Cars added here join the simulation on the first tick their spot is
+    // free, or are turned away if their spawn point is full.
+    bool add(const Car& car) {
+        std::unique_lock lock(pendingMutex);
+        return pending.push(car);
+    }
+
+    uint64_t turnedAway() {
+        std::unique_lock lock(pendingMutex);
+        return pending.turnedAway();
+    }
+
+    size_t size() {
+        std::unique_lock lock(carsMutex);
+        return cars.size();
+    }
+
+    // How long the last tick took, from admitting the new cars to publishing
+    // the snapshot.
+    float lastStepMs() const {
+        return stepMs.load(std::memory_order_relaxed);
+    }
+
+private:
+    CarSystem& carSystem;
+    SimClock& clock;
+    TripleBuffer<Snapshot>& snapshots;
+    size_t numWorkers;
+    const bool carFollowing;
+
+    std::mutex carsMutex;
+    std::vector<Car> cars;
+    std::vector<uint8_t> finished;
+    std::vector<float> advance;
+    SpatialHash grid;
+
+    std::mutex pendingMutex;
+    SpawnQueues pending;
+
+    std::barrier<> tickBarrier;
+    std::barrier<> followBarrier;
+    std::barrier<> doneBarrier;
+    bool stopping = false;
+    std::atomic<float> stepMs = 0.0f;
+
+    std::vector<std::jthread> workers;
+
+    void coordinate(std::stop_token stop) {
+        Tracer::get().nameThread("pool worker 0");
+        while(!stop.stop_requested() && !carSystem.exit) {
+            uint64_t tick = clock.advanceNext();
+            auto stepStart = chrono::steady_clock::now();
+            TraceSpan span("tick", "tick", tick);
+
+            std::unique_lock lock(carsMutex);
+            admitPending();
+            finished.assign(cars.size(), false);
+            advance.resize(cars.size());
+            if(carFollowing) {
+                grid.build(cars.size(), [&](size_t i) { return cars[i].position; });
+            }
+
+            tickBarrier.arrive_and_wait();
+            step(0);
+            doneBarrier.arrive_and_wait();
+
+            size_t kept = 0;
+            for(size_t i = 0; i < cars.size(); ++i) {
+                if(!finished[i]) {
+                    cars[kept++] = cars[i];
+                }
+            }
+            cars.erase(cars.begin() + kept, cars.end());
+
+            Snapshot& snapshot = snapshots.writeBuffer();
+            snapshot.tick = tick;
+            snapshot.cars.clear();
+            for(auto& car: cars) {
+                snapshot.cars.push_back({car.position, car.id});
+            }
+            snapshot.arrange(carSystem.network.size);
+            snapshots.publish();
+            stepMs.store(chrono::duration_cast<ms>(chrono::steady_clock::now() - stepStart).count(), std::memory_order_relaxed);
+        }
+
+        stopping = true;
+        tickBarrier.arrive_and_wait();
+    }
+
+    void work(size_t index) {
+        Tracer::get().nameThread("pool worker");
+        while(true) {
+            tickBarrier.arrive_and_wait();
+            if(stopping) {
+                return;
+            }
+            step(index);
+            doneBarrier.arrive_and_wait();
+        }
+    }
+
+    // Without following every waiting car is simply added at the end.
+    void admitPending() {
+        std::unique_lock pendingLock(pendingMutex);
+        size_t existing = cars.size();
+        if(carFollowing) {
+            grid.build(existing, [&](size_t i) { return cars[i].position; });
+        }
+        pending.admit([&](const Car& car) {
+            bool free = true;
+            if(carFollowing) {
+                free = isFree(grid, [&](size_t i) { return cars[i].position; }, car.position);
+                for(size_t i = existing; i < cars.size() && free; ++i) {
+                    Vec2 d = cars[i].position - car.position;
+                    free = std::abs(d.x) >= CAR_SIZE || std::abs(d.y) >= CAR_SIZE;
+                }
+            }
+            if(free) {
+                cars.push_back(car);
+                carSystem.join(car);
+            }
+            return free;
+        });
+    }
+
+    void step(size_t index) {
+        TraceSpan span("step");
+        size_t begin = cars.size() * index / numWorkers;
+        size_t end = cars.size() * (index + 1) / numWorkers;
+        for(size_t i = begin; i < end; ++i) {
+            advance[i] = carFollowing
+                ? followDistance(grid, i, cars[i].speed,
+                    [&](size_t j) { return cars[j].position; },
+                    [&](size_t j) { return direction(cars[j].state); })
+                : cars[i].speed;
+        }
+        followBarrier.arrive_and_wait();
+        for(size_t i = begin; i < end; ++i) {
+            finished[i] = carSystem.updateCar(cars[i], false, advance[i]);
+        }
+    }
+};
@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "scenario.cpp"
+
+// Runs the spawns of a recorded event log again, headless and as fast as
+// possible, and compares what happened with the recording. Recording with
+// one build and replaying with another shows how a change to e.g. the token
+// arbiter affects the exact same traffic.
+//
+// usage: replay <events.bin> [replayed events.bin] [roads.txt] [fifo|phase]
+//
+// The roads have to be the ones the log was recorded on, by default the
+// track from layout.cpp. The admission policy (see admission.cpp) can be
+// another one than the recording's, to compare them on the same spawns.
+//
+// The replayed cars get new ids; they're matched to the recorded ones by the
+// order they were spawned in. A run recorded by the windowed app depends on
+// thread timing, so only its spawns are expected to match.
+
+struct RunSummary {
+    uint64_t counts[EVENT_EXIT + 1] = {};
+    uint64_t trips = 0;
+    uint64_t tripTicks = 0;
+
+    RunSummary(const std::vector<Event>& events) {
+        std::unordered_map<uint32_t, uint32_t> spawnTick;
+        for(auto& event: events) {
+            if(event.type <= EVENT_EXIT) {
+                ++counts[event.type];
+            }
+            if(event.type == EVENT_SPAWN_TRACK || event.type == EVENT_SPAWN_CROSS) {
+                spawnTick[event.car] = event.tick;
+            } else if(event.type == EVENT_EXIT && spawnTick.count(event.car)) {
+                ++trips;
+                tripTicks += event.tick - spawnTick[event.car];
+            }
+        }
+    }
+
+    double meanTripTicks() const {
+        return trips ? double(tripTicks) / trips : 0.0;
+    }
+};
+
+std::ostream& operator<<(std::ostream& out, const Event& event) {
+    return out << "tick " << event.tick << " " << eventName(event.type) << " car " << event.car
+        << " region " << int(event.region);
+}
+
+int main(int argc, char** argv) {
+    if(argc < 2) {
+        std::cerr << "usage: replay <events.bin> [replayed events.bin] [roads.txt] [fifo|phase]\n";
+        return 1;
+    }
+
+    std::vector<Event> recorded;
+    uint64_t dropped = 0;
+    if(!EventLog::read(argv[1], recorded, dropped)) {
+        std::cerr << argv[1] << " is not an event log\n";
+        return 1;
+    }
+    if(dropped > 0) {
+        std::cerr << argv[1] << " lost its " << dropped << " oldest events while recording, can't replay it\n";
+        return 1;
+    }
+    // up to the last recorded event
+    uint64_t numTicks = 0;
+    for(auto& event: recorded) {
+        numTicks = std::max<uint64_t>(numTicks, event.tick + 1);
+    }
+
+    RoadNetwork network = RoadNetwork::standard();
+    if(argc > 3 && argv[3][0] && !network.load(argv[3])) {
+        return 1;
+    }
+
+    Scenario scenario(network, recorded);
+    if(argc > 4 && !scenario.carSystem.setAdmissionPolicy(argv[4])) {
+        std::cerr << "unknown admission policy " << argv[4] << "\n";
+        return 1;
+    }
+    EventLog replayed(scenario.clock, std::max<size_t>(2 * recorded.size(), 1 << 20));
+    scenario.carSystem.setEventLog(&replayed);
+
+    auto start = chrono::steady_clock::now();
+    for(uint64_t tick = 0; tick < numTicks; ++tick) {
+        scenario.step();
+    }
+    float elapsed = chrono::duration_cast<ms>(chrono::steady_clock::now() - start).count();
+
+    std::vector<Event> events = replayed.events();
+
+    // recorded id -> replayed id, spawns come in the same order in both
+    std::unordered_map<uint32_t, uint32_t> ids;
+    std::vector<Event> expected, actual;
+    for(auto& event: recorded) {
+        if(event.type == EVENT_SPAWN_TRACK || event.type == EVENT_SPAWN_CROSS) {
+            ids.emplace(event.car, ids.size());
+        }
+    }
+    std::vector<uint32_t> replayedSpawns;
+    for(auto& event: events) {
+        if(event.type == EVENT_SPAWN_TRACK || event.type == EVENT_SPAWN_CROSS) {
+            replayedSpawns.push_back(event.car);
+        } else {
+            actual.push_back(event);
+        }
+    }
+    for(auto event: recorded) {
+        if(event.type == EVENT_SPAWN_TRACK || event.type == EVENT_SPAWN_CROSS) {
+            continue;
+        }
+        auto id = ids.find(event.car);
+        event.car = id != ids.end() && id->second < replayedSpawns.size() ? replayedSpawns[id->second] : UINT32_MAX;
+        expected.push_back(event);
+    }
+
+    RunSummary before(recorded), after(events);
+
+    std::cout.precision(3);
+    std::cout << "ticks: " << numTicks << "   ";
+    std::cout << "elapsed: " << std::fixed << elapsed << " ms   ";
+    std::cout << "ticks/s: " << std::fixed << numTicks / (elapsed / 1000.0f) << '\n';
+    std::cout << std::setw(12) << "" << std::setw(12) << "recorded" << std::setw(12) << "replayed" << '\n';
+    for(int type = 0; type <= EVENT_EXIT; ++type) {
+        std::cout << std::setw(12) << eventName(type) << std::setw(12) << before.counts[type]
+            << std::setw(12) << after.counts[type] << '\n';
+    }
+    std::cout << std::setw(12) << "mean trip" << std::setw(12) << before.meanTripTicks()
+        << std::setw(12) << after.meanTripTicks() << "  ticks\n";
+
+    auto mismatch = std::mismatch(expected.begin(), expected.end(), actual.begin(), actual.end());
+    if(mismatch.first == expected.end() && mismatch.second == actual.end()) {
+        std::cout << "identical: " << expected.size() << " events\n";
+    } else {
+        std::cout << "diverged at event " << mismatch.first - expected.begin() << ":\n";
+        std::cout << "  recorded: ";
+        if(mismatch.first != expected.end()) std::cout << *mismatch.first; else std::cout << "(end)";
+        std::cout << "\n  replayed: ";
+        if(mismatch.second != actual.end()) std::cout << *mismatch.second; else std::cout << "(end)";
+        std::cout << '\n';
+    }
+
+    if(argc > 2 && argv[2][0]) {
+        replayed.write(argv[2]);
+    }
+
+    return mismatch.first == expected.end() && mismatch.second == actual.end() ? 0 : 2;
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <optional>
+#include <random>
+
+#include "carstore.cpp"
+#include "clock.cpp"
+#include "eventlog.cpp"
+#include "spawner.cpp"
+
+// The traffic of the windowed spawners, stepped tick by tick on the calling
+// thread: NUM_CARS cars on the loops, cars on the roads until the end, each
+// spawned 100..1000 ms of simulated time after the previous one on a random
+// loop or road of the network.
+//
+// Everything depends only on the seed, so two runs with the same seed do the
+// same thing tick for tick. A scenario can also draw its cars from a
+// SpawnPlan, or replay the spawns of a recorded EventLog.
+struct Scenario {
+    CarSystem carSystem;
+    CarStore cars;
+    // never real time, one tick per step
+    SimClock clock{false};
+
+    int numTrackCars;
+    int spawnedTrackCars = 0;
+
+    Scenario(const RoadNetwork& network, int numTrackCars, uint32_t seed)
+        : carSystem(network), numTrackCars(network.loops.empty() ? 0 : numTrackCars), gen(seed) {
+        nextTrackSpawn = nextSpawnTicksDist(gen);
+        nextCrossSpawn = nextSpawnTicksDist(gen);
+    }
+
+    Scenario(const RoadNetwork& network, const SpawnPlan& plan, uint32_t seed)
+        : carSystem(network), numTrackCars(0), gen(seed) {
+        spawner.emplace(carSystem.network, plan, seed);
+    }
+
+    // Spawns exactly the cars spawned in `recorded`, at the same ticks. The
+    // cars get new ids, in the order of the log.
+    Scenario(const RoadNetwork& network, const std::vector<Event>& recorded)
+        : carSystem(network), numTrackCars(0), gen(0), replaying(true) {
+        for(auto& event: recorded) {
+            if(event.type == EVENT_SPAWN_TRACK || event.type == EVENT_SPAWN_CROSS) {
+                script.push_back(event);
+            }
+        }
+    }
+
+    // Cars that got on the road, not counting the ones waiting at a spawn
+    // point.
+    uint64_t spawned() const {
+        return carSystem.joined;
+    }
+
+    // Cars turned away, by the spawn plan because there were too many alive
+    // or because their spawn point was full.
+    uint64_t throttled() const {
+        return (spawner ? spawner->throttled() : 0) + cars.turnedAway();
+    }
+
+    uint64_t tick() const {
+        return clock.now();
+    }
+
+    // Whether a replay has spawned everything from its log.
+    bool scriptDone() const {
+        return nextScripted == script.size();
+    }
+
+    void step() {
+        uint64_t now = clock.now();
+        if(replaying) {
+            for(; nextScripted < script.size() && script[nextScripted].tick <= now; ++nextScripted) {
+                const Event& event = script[nextScripted];
+                Vec2 offset{float(event.offsetX), float(event.offsetY)};
+                if(event.type == EVENT_SPAWN_TRACK) {
+                    cars.spawn(Car::spawnTrack(network().loopStart(event.road), offset, event.speed, event.road));
+                } else {
+                    cars.spawn(Car::spawnCross(network().roadStart(event.road), offset, event.speed, event.road));
+                }
+            }
+        } else if(spawner) {
+            batch.clear();
+            spawner->spawnDue(carSystem.joined - carSystem.exited, batch);
+            for(auto& car: batch) {
+                cars.spawn(car);
+            }
+        } else {
+            if(now == nextTrackSpawn && spawnedTrackCars < numTrackCars) {
+                uint16_t loop = pick(network().loops.size());
+                float x = car_offset_dist(gen);
+                float y = car_offset_dist(gen);
+                cars.spawn(Car::spawnTrack(network().loopStart(loop), {x, y}, speed_dist(gen), loop));
+                ++spawnedTrackCars;
+                nextTrackSpawn = now + nextSpawnTicksDist(gen);
+            }
+            if(now == nextCrossSpawn && !network().roads.empty()) {
+                uint16_t road = pick(network().roads.size());
+                float x = car_offset_dist(gen);
+                float y = car_offset_dist(gen);
+                cars.spawn(Car::spawnCross(network().roadStart(road), {x, y}, speed_dist(gen), road));
+                nextCrossSpawn = now + nextSpawnTicksDist(gen);
+            }
+        }
+
+        cars.step(carSystem);
+        clock.advanceNext();
+    }
+
+private:
+    std::mt19937 gen;
+    std::uniform_int_distribution<int> car_offset_dist{int(-network().thickness / 4), int(network().thickness / 4)};
+    std::uniform_real_distribution<float> speed_dist{CAR_SPEED_MIN, CAR_SPEED_MAX};
+    std::uniform_int_distribution<int> nextSpawnTicksDist{SimClock::TICKS_PER_SECOND / 10, SimClock::TICKS_PER_SECOND};
+
+    uint64_t nextTrackSpawn = 0;
+    uint64_t nextCrossSpawn = 0;
+
+    std::optional<Spawner> spawner;
+    std::vector<Car> batch;
+
+    bool replaying = false;
+    std::vector<Event> script;
+    size_t nextScripted = 0;
+
+    const RoadNetwork& network() const {
+        return carSystem.network;
+    }
+
+    // Doesn't draw from gen when there's only one to pick from.
+    uint16_t pick(size_t n) {
+        return n > 1 ? std::uniform_int_distribution<size_t>(0, n - 1)(gen) : 0;
+    }
+};
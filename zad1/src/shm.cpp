@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "snapshot.cpp"
+
+// Snapshots in POSIX shared memory, for viewers in other processes (see
+// viewer.cpp). One process creates the ring and copies a snapshot per tick,
+// already arranged into cells (see Snapshot), into the next of its slots; any
+// number of viewers map it and read the newest one, without the writer ever
+// waiting for them or knowing they are there.
+//
+// Every slot has a seqlock: its sequence is odd while it's being written. A
+// reader copies the slot out and only keeps the copy if the sequence was even
+// and the same before and after. With a few slots a reader has a few ticks to
+// finish its copy before the writer comes around to that slot again.
+class SnapshotRing {
+public:
+    static const uint32_t DEFAULT_SLOTS = 8;
+
+    SnapshotRing() = default;
+    SnapshotRing(const SnapshotRing&) = delete;
+    SnapshotRing& operator=(const SnapshotRing&) = delete;
+
+    ~SnapshotRing() {
+        if(header) {
+            munmap(header, bytes);
+        }
+        if(owner) {
+            shm_unlink(name.c_str());
+        }
+    }
+
+    // Makes a new ring called `name` (like "/traffic") with room for
+    // `capacity` cars per snapshot, arranged into `grid`, replacing any old
+    // one of that name. The ring is removed when this object is destroyed,
+    // viewers that have it mapped keep the last snapshots.
+    bool create(const std::string& name, uint32_t capacity, const CellGrid& grid, uint32_t slots = DEFAULT_SLOTS) {
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if(fd < 0) {
+            std::cerr << "can't create shared memory " << name << ": " << std::strerror(errno) << "\n";
+            return false;
+        }
+        size_t size = sizeof(Header) + size_t(slots) * slotBytes(capacity, grid.cells());
+        bool ok = ftruncate(fd, size) == 0 && map(fd, size, PROT_READ | PROT_WRITE);
+        close(fd);
+        if(!ok) {
+            std::cerr << "can't map shared memory " << name << ": " << std::strerror(errno) << "\n";
+            shm_unlink(name.c_str());
+            return false;
+        }
+
+        // fresh pages are zero, so every slot starts out unwritten and even
+        header->capacity = capacity;
+        header->cols = grid.cols;
+        header->rows = grid.rows;
+        header->slots = slots;
+        header->version = VERSION;
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = MAGIC;
+        this->name = name;
+        owner = true;
+        return true;
+    }
+
+    // Maps a ring some other process created, read only.
+    bool open(const std::string& name) {
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if(fd < 0) {
+            std::cerr << "can't open shared memory " << name << ": " << std::strerror(errno) << "\n";
+            return false;
+        }
+        struct stat info;
+        bool ok = fstat(fd, &info) == 0 && size_t(info.st_size) >= sizeof(Header) && map(fd, info.st_size, PROT_READ);
+        close(fd);
+        if(!ok || header->magic != MAGIC || header->version != VERSION || header->slots == 0
+            || sizeof(Header) + size_t(header->slots) * slotBytes(header->capacity, grid().cells()) > bytes) {
+            std::cerr << name << " is not a snapshot ring\n";
+            return false;
+        }
+        this->name = name;
+        return true;
+    }
+
+    uint32_t capacity() const {
+        return header->capacity;
+    }
+
+    // Only for the process that created the ring. `snapshot` has to be
+    // arranged into the ring's grid; cars over the capacity are left out.
+    void publish(const Snapshot& snapshot) {
+        uint64_t n = header->published.load(std::memory_order_relaxed);
+        Slot* s = slot(n % header->slots);
+        uint32_t count = std::min<size_t>(snapshot.cars.size(), header->capacity);
+        uint32_t cells = grid().cells();
+        bool arranged = snapshot.grid.cols == header->cols && snapshot.grid.rows == header->rows;
+
+        uint64_t seq = s->seq.load(std::memory_order_relaxed);
+        s->seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        s->tick = snapshot.tick;
+        s->count = count;
+        std::memcpy(s->cars(), snapshot.cars.data(), count * sizeof(CarSnapshot));
+        uint32_t* start = cellStart(s);
+        for(uint32_t c = 0; c <= cells; ++c) {
+            start[c] = arranged ? std::min(snapshot.cellStart[c], count) : count;
+        }
+        s->seq.store(seq + 2, std::memory_order_release);
+
+        header->published.store(n + 1, std::memory_order_release);
+    }
+
+    // Copies the newest snapshot into `out`. Returns false if nothing was
+    // published yet or the writer kept overwriting the slot while we read.
+    bool read(Snapshot& out) const {
+        const int ATTEMPTS = 4;
+        for(int attempt = 0; attempt < ATTEMPTS; ++attempt) {
+            uint64_t n = header->published.load(std::memory_order_acquire);
+            if(n == 0) {
+                return false;
+            }
+            const Slot* s = slot((n - 1) % header->slots);
+
+            uint64_t before = s->seq.load(std::memory_order_acquire);
+            if(before % 2) {
+                continue;
+            }
+            uint64_t tick = s->tick;
+            uint32_t count = std::min(s->count, header->capacity);
+            out.cars.resize(count);
+            std::memcpy(out.cars.data(), s->cars(), count * sizeof(CarSnapshot));
+            out.grid = grid();
+            const uint32_t* start = cellStart(s);
+            out.cellStart.resize(out.grid.cells() + 1);
+            for(uint32_t c = 0; c <= out.grid.cells(); ++c) {
+                out.cellStart[c] = std::min(start[c], count);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(s->seq.load(std::memory_order_relaxed) == before) {
+                out.tick = tick;
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    static const uint32_t MAGIC = 0x53524e47; // "SRNG"
+    static const uint32_t VERSION = 2;
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t slots;
+        uint32_t capacity;
+        uint32_t cols;
+        uint32_t rows;
+        // snapshots written so far, the newest is in slot (published - 1) % slots
+        alignas(64) std::atomic<uint64_t> published;
+    };
+
+    struct Slot {
+        alignas(64) std::atomic<uint64_t> seq;
+        uint64_t tick;
+        uint32_t count;
+
+        // the cars come right after the slot, then the cell table
+        CarSnapshot* cars() {
+            return reinterpret_cast<CarSnapshot*>(this + 1);
+        }
+        const CarSnapshot* cars() const {
+            return reinterpret_cast<const CarSnapshot*>(this + 1);
+        }
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "the seqlocks are shared between processes");
+    static_assert(std::is_trivially_copyable_v<CarSnapshot>);
+
+    Header* header = nullptr;
+    size_t bytes = 0;
+    std::string name;
+    bool owner = false;
+
+    static size_t slotBytes(uint32_t capacity, uint32_t cells) {
+        // keeps every slot on its own cache lines
+        return (sizeof(Slot) + capacity * sizeof(CarSnapshot) + (cells + 1) * sizeof(uint32_t) + 63) / 64 * 64;
+    }
+
+    CellGrid grid() const {
+        return {header->cols, header->rows};
+    }
+
+    uint32_t* cellStart(Slot* s) const {
+        return reinterpret_cast<uint32_t*>(s->cars() + header->capacity);
+    }
+    const uint32_t* cellStart(const Slot* s) const {
+        return reinterpret_cast<const uint32_t*>(s->cars() + header->capacity);
+    }
+
+    bool map(int fd, size_t size, int protection) {
+        void* memory = mmap(nullptr, size, protection, MAP_SHARED, fd, 0);
+        if(memory == MAP_FAILED) {
+            return false;
+        }
+        header = static_cast<Header*>(memory);
+        bytes = size;
+        return true;
+    }
+
+    Slot* slot(uint64_t i) const {
+        char* first = reinterpret_cast<char*>(header) + sizeof(Header);
+        return reinterpret_cast<Slot*>(first + i * slotBytes(header->capacity, grid().cells()));
+    }
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Pool of T objects in fixed size chunks, so an object never moves while it
+// is alive and freed slots are reused without going back to the allocator.
+// Objects are named by a Handle, which stops being valid when the object is
+// destroyed (the slot generation changes).
+//
+// The live objects are also listed densely in `live`; destroying one moves
+// the last entry into its place, so both create and destroy are O(1) and
+// forEach only visits live objects.
+//
+// Not thread safe, callers lock around create/destroy/get themselves. A
+// reference from get() stays valid until that object is destroyed.
+template <typename T>
+class SlabPool {
+public:
+    struct Handle {
+        uint32_t slot = 0;
+        uint32_t generation = 0;
+    };
+
+    static const uint32_t CHUNK_SIZE = 256;
+
+    SlabPool() = default;
+    SlabPool(const SlabPool&) = delete;
+    SlabPool& operator=(const SlabPool&) = delete;
+
+    ~SlabPool() {
+        for(uint32_t slot: live) {
+            object(slot).~T();
+        }
+    }
+
+    template <typename... Args>
+    Handle create(Args&&... args) {
+        if(freeSlots.empty()) {
+            grow();
+        }
+        uint32_t slot = freeSlots.back();
+        new(&slots(slot).storage) T(std::forward<Args>(args)...);
+        freeSlots.pop_back();
+
+        slots(slot).liveIndex = live.size();
+        live.push_back(slot);
+        return {slot, slots(slot).generation};
+    }
+
+    void destroy(Handle handle) {
+        if(!valid(handle)) {
+            return;
+        }
+        Slot& slot = slots(handle.slot);
+        object(handle.slot).~T();
+        ++slot.generation;
+
+        uint32_t moved = live.back();
+        live[slot.liveIndex] = moved;
+        slots(moved).liveIndex = slot.liveIndex;
+        live.pop_back();
+
+        freeSlots.push_back(handle.slot);
+    }
+
+    bool valid(Handle handle) const {
+        return handle.slot < chunks.size() * CHUNK_SIZE
+            && slots(handle.slot).generation == handle.generation
+            && slots(handle.slot).liveIndex < live.size()
+            && live[slots(handle.slot).liveIndex] == handle.slot;
+    }
+
+    T& get(Handle handle) {
+        return object(handle.slot);
+    }
+
+    template <typename F>
+    void forEach(F f) {
+        for(uint32_t slot: live) {
+            f(object(slot));
+        }
+    }
+
+    // Destroys every live object `pred` returns true for.
+    template <typename F>
+    void destroyIf(F pred) {
+        // from the back, so the entry moved into a freed place was visited
+        for(size_t i = live.size(); i-- > 0;) {
+            uint32_t slot = live[i];
+            if(pred(object(slot))) {
+                destroy({slot, slots(slot).generation});
+            }
+        }
+    }
+
+    size_t size() const {
+        return live.size();
+    }
+
+private:
+    struct Slot {
+        alignas(T) std::byte storage[sizeof(T)];
+        uint32_t generation = 0;
+        uint32_t liveIndex = 0;
+    };
+
+    std::vector<std::unique_ptr<Slot[]>> chunks;
+    std::vector<uint32_t> freeSlots;
+    std::vector<uint32_t> live;
+
+    Slot& slots(uint32_t slot) {
+        return chunks[slot / CHUNK_SIZE][slot % CHUNK_SIZE];
+    }
+
+    const Slot& slots(uint32_t slot) const {
+        return chunks[slot / CHUNK_SIZE][slot % CHUNK_SIZE];
+    }
+
+    T& object(uint32_t slot) {
+        return *std::launder(reinterpret_cast<T*>(&slots(slot).storage));
+    }
+
+    void grow() {
+        uint32_t first = chunks.size() * CHUNK_SIZE;
+        chunks.push_back(std::make_unique<Slot[]>(CHUNK_SIZE));
+        live.reserve(first + CHUNK_SIZE);
+        freeSlots.reserve(first + CHUNK_SIZE);
+        // lowest slots on top, so they're handed out first
+        for(uint32_t slot = first + CHUNK_SIZE; slot > first; --slot) {
+            freeSlots.push_back(slot - 1);
+        }
+    }
+};
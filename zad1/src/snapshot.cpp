@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "cars.cpp"
+#include "clock.cpp"
+
+// What the renderer needs to know about a car.
+struct CarSnapshot {
+    Vec2 position;
+    uint32_t id;
+};
+
+// Squares of CELL_SIZE over the world, for finding the cars of a snapshot
+// by where they are. Anything off the world counts as in the nearest edge
+// cell.
+struct CellGrid {
+    inline static const float CELL_SIZE = 256.0f;
+
+    uint32_t cols = 0;
+    uint32_t rows = 0;
+
+    static CellGrid over(const Vec2& size) {
+        return {std::max(1u, uint32_t(std::ceil(size.x / CELL_SIZE))), std::max(1u, uint32_t(std::ceil(size.y / CELL_SIZE)))};
+    }
+
+    uint32_t cells() const {
+        return cols * rows;
+    }
+
+    uint32_t col(float x) const {
+        return std::clamp<int64_t>(int64_t(std::floor(x / CELL_SIZE)), 0, int64_t(cols) - 1);
+    }
+
+    uint32_t row(float y) const {
+        return std::clamp<int64_t>(int64_t(std::floor(y / CELL_SIZE)), 0, int64_t(rows) - 1);
+    }
+};
+
+// State of all cars after one simulation step.
+//
+// Whoever makes a snapshot arranges it before publishing, so the renderer
+// only has to look at the cells it shows: the cars are sorted by the cell
+// they're in and by id inside a cell, the ones in cell c are
+// cars[cellStart[c]] up to cars[cellStart[c + 1]].
+struct Snapshot {
+    uint64_t tick = 0;
+    std::vector<CarSnapshot> cars;
+    CellGrid grid;
+    std::vector<uint32_t> cellStart;
+
+    // A counting sort into the cells, then each cell by id.
+    void arrange(const Vec2& worldSize) {
+        grid = CellGrid::over(worldSize);
+        cellStart.assign(grid.cells() + 1, 0);
+        for(auto& car: cars) {
+            ++cellStart[cellOf(car.position) + 1];
+        }
+        for(uint32_t c = 0; c < grid.cells(); ++c) {
+            cellStart[c + 1] += cellStart[c];
+        }
+
+        unsorted.swap(cars);
+        cars.resize(unsorted.size());
+        fill.assign(cellStart.begin(), cellStart.end() - 1);
+        for(auto& car: unsorted) {
+            cars[fill[cellOf(car.position)]++] = car;
+        }
+        for(uint32_t c = 0; c < grid.cells(); ++c) {
+            std::sort(cars.begin() + cellStart[c], cars.begin() + cellStart[c + 1],
+                [](const CarSnapshot& a, const CarSnapshot& b) { return a.id < b.id; });
+        }
+    }
+
+    // Calls f(car) for every car in the cells touching `area`.
+    template <typename F>
+    void forEachInRect(const Rect& area, F f) const {
+        if(!grid.cells()) {
+            return;
+        }
+        for(uint32_t row = grid.row(area.top); row <= grid.row(area.top + area.height); ++row) {
+            for(uint32_t col = grid.col(area.left); col <= grid.col(area.left + area.width); ++col) {
+                uint32_t c = row * grid.cols + col;
+                for(uint32_t i = cellStart[c]; i < cellStart[c + 1]; ++i) {
+                    f(cars[i]);
+                }
+            }
+        }
+    }
+
+    // The car with `id` if it's in the cell at `position` or one next to it.
+    const CarSnapshot* find(uint32_t id, const Vec2& position) const {
+        if(!grid.cells()) {
+            return nullptr;
+        }
+        int64_t col = grid.col(position.x), row = grid.row(position.y);
+        for(int64_t r = std::max<int64_t>(row - 1, 0); r <= std::min<int64_t>(row + 1, grid.rows - 1); ++r) {
+            for(int64_t c = std::max<int64_t>(col - 1, 0); c <= std::min<int64_t>(col + 1, grid.cols - 1); ++c) {
+                auto begin = cars.begin() + cellStart[r * grid.cols + c];
+                auto end = cars.begin() + cellStart[r * grid.cols + c + 1];
+                auto car = std::lower_bound(begin, end, id, [](const CarSnapshot& car, uint32_t id) { return car.id < id; });
+                if(car != end && car->id == id) {
+                    return &*car;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+private:
+    std::vector<CarSnapshot> unsorted;
+    std::vector<uint32_t> fill;
+
+    uint32_t cellOf(const Vec2& position) const {
+        return grid.row(position.y) * grid.cols + grid.col(position.x);
+    }
+};
+
+// A car driven by its own thread. Only that thread touches `car`, everyone
+// else reads `published`. The thread sets `finished` as the last thing it
+// does, whoever owns the car joins it then.
+struct ThreadedCar {
+    Car car;
+    std::atomic<Vec2> published;
+    std::atomic<bool> finished = false;
+    std::jthread thread;
+
+    ThreadedCar(const Car& car): car(car), published(car.position) {}
+};
+
+// Single producer, single consumer triple buffer. The producer fills
+// writeBuffer() and publishes it, the consumer always gets the newest
+// published buffer. Neither side ever waits for the other: they only swap
+// indexes through `middle`.
+template <typename T>
+class TripleBuffer {
+public:
+    // Only for the producer. Holds whatever was written two publishes ago,
+    // so it's cheap to refill without allocating.
+    T& writeBuffer() {
+        return buffers[writeIndex];
+    }
+
+    void publish() {
+        writeIndex = middle.exchange(writeIndex | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // Only for the consumer. Stays valid until the next call.
+    const T& read() {
+        if(middle.load(std::memory_order_relaxed) & FRESH) {
+            readIndex = middle.exchange(readIndex, std::memory_order_acq_rel) & INDEX;
+        }
+        return buffers[readIndex];
+    }
+
+private:
+    static const uint8_t INDEX = 0x3;
+    static const uint8_t FRESH = 0x4;
+
+    T buffers[3];
+    // kept on separate cache lines, each one is touched by a different thread
+    alignas(64) uint8_t writeIndex = 0;
+    alignas(64) std::atomic<uint8_t> middle = 1;
+    alignas(64) uint8_t readIndex = 2;
+};
+
+// Keeps the last two snapshots the renderer got and blends between them, so
+// the cars move smoothly whether frames come faster or slower than ticks.
+// What's drawn is up to one snapshot behind the simulation.
+//
+// Only the cars in view are blended: a frame only goes through the cells of
+// the snapshot it shows, and finds where a car was in the previous snapshot
+// in the cells around it, so it doesn't depend on how many cars there are
+// elsewhere.
+class SnapshotInterpolator {
+public:
+    // Takes `snapshot` if it's newer than the last one, `now` is when it
+    // arrived.
+    void update(const Snapshot& snapshot, chrono::steady_clock::time_point now) {
+        if(snapshot.tick <= current.tick) {
+            return;
+        }
+        std::swap(previous, current);
+        current.tick = snapshot.tick;
+        current.cars.assign(snapshot.cars.begin(), snapshot.cars.end());
+        current.grid = snapshot.grid;
+        current.cellStart.assign(snapshot.cellStart.begin(), snapshot.cellStart.end());
+        currentAt = now;
+    }
+
+    // The cars in `visible` at `now`: moved from the previous snapshot
+    // towards the current one in the time the ticks between them take. Cars
+    // that just spawned are where they are in the current one.
+    void at(chrono::steady_clock::time_point now, const Rect& visible, std::vector<CarSnapshot>& out) {
+        float alpha = 1.0f;
+        if(current.tick > previous.tick) {
+            chrono::duration<float> span = SimClock::TICK * (current.tick - previous.tick);
+            alpha = std::clamp(chrono::duration<float>(now - currentAt) / span, 0.0f, 1.0f);
+        }
+
+        out.clear();
+        Rect area{visible.left - CAR_SIZE, visible.top - CAR_SIZE, visible.width + 2 * CAR_SIZE, visible.height + 2 * CAR_SIZE};
+        current.forEachInRect(area, [&](const CarSnapshot& car) {
+            if(!area.contains(car.position)) {
+                return;
+            }
+            Vec2 position = car.position;
+            if(const CarSnapshot* from = previous.find(car.id, car.position)) {
+                Vec2 p = from->position;
+                position = {p.x + (car.position.x - p.x) * alpha, p.y + (car.position.y - p.y) * alpha};
+            }
+            out.push_back({position, car.id});
+        });
+    }
+
+private:
+    Snapshot previous;
+    Snapshot current;
+    chrono::steady_clock::time_point currentAt;
+};
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "car.cpp"
+
+// Uniform grid of CELL_SIZE squares, hashed into a table about twice the
+// number of cars, so it doesn't care how big the world is. Rebuilt from
+// scratch every tick with a counting sort: cars of a cell end up next to each
+// other in `entries`, between cellStart[cell] and cellStart[cell + 1].
+class SpatialHash {
+public:
+    inline static const float CELL_SIZE = 2 * CAR_SIZE;
+
+    template <typename Position>
+    void build(size_t n, Position position) {
+        size_t tableSize = std::bit_ceil(std::max<size_t>(2 * n, 16));
+        mask = tableSize - 1;
+
+        cellOf.resize(n);
+        cellStart.assign(tableSize + 1, 0);
+        for(size_t i = 0; i < n; ++i) {
+            Vec2 p = position(i);
+            cellOf[i] = cellIndex(cellCoord(p.x), cellCoord(p.y));
+            ++cellStart[cellOf[i] + 1];
+        }
+        for(size_t c = 0; c < tableSize; ++c) {
+            cellStart[c + 1] += cellStart[c];
+        }
+
+        entries.resize(n);
+        fill.assign(cellStart.begin(), cellStart.end() - 1);
+        for(size_t i = 0; i < n; ++i) {
+            entries[fill[cellOf[i]]++] = i;
+        }
+    }
+
+    // Calls f(index) for every car in the cells touching the rectangle. Cars
+    // from other cells hashed to the same slot come along too, so f still has
+    // to check the actual distance.
+    template <typename F>
+    void forEachInRect(const Rect& rect, F f) const {
+        int32_t x0 = cellCoord(rect.left), x1 = cellCoord(rect.left + rect.width);
+        int32_t y0 = cellCoord(rect.top), y1 = cellCoord(rect.top + rect.height);
+        for(int32_t cy = y0; cy <= y1; ++cy) {
+            for(int32_t cx = x0; cx <= x1; ++cx) {
+                uint32_t cell = cellIndex(cx, cy);
+                for(uint32_t e = cellStart[cell]; e < cellStart[cell + 1]; ++e) {
+                    f(entries[e]);
+                }
+            }
+        }
+    }
+
+private:
+    uint32_t mask = 0;
+    std::vector<uint32_t> cellOf;
+    std::vector<uint32_t> cellStart;
+    std::vector<uint32_t> fill;
+    std::vector<uint32_t> entries;
+
+    static int32_t cellCoord(float v) {
+        return int32_t(std::floor(v / CELL_SIZE));
+    }
+
+    uint32_t cellIndex(int32_t cx, int32_t cy) const {
+        return (uint32_t(cx) * 73856093u ^ uint32_t(cy) * 19349663u) & mask;
+    }
+};
+
+// Car following: cars keep MIN_GAP pixels between their bumper and the car in
+// front of them in the same lane, i.e. going the same way and overlapping
+// sideways. Only cars closer than LOOKAHEAD are looked at.
+const float MIN_GAP = 4.0f;
+const float LOOKAHEAD = SpatialHash::CELL_SIZE;
+
+// How far car i may move this tick: its speed, or less if that would take it
+// too close to the car ahead.
+template <typename Position, typename Direction>
+float followDistance(const SpatialHash& grid, size_t i, float speed, Position position, Direction direction) {
+    Vec2 p = position(i);
+    Vec2 dir = direction(i);
+    float allowed = speed;
+    grid.forEachInRect({p.x - LOOKAHEAD, p.y - LOOKAHEAD, 2 * LOOKAHEAD, 2 * LOOKAHEAD}, [&](uint32_t j) {
+        if(j == i) {
+            return;
+        }
+        Vec2 otherDir = direction(j);
+        if(otherDir.x != dir.x || otherDir.y != dir.y) {
+            return;
+        }
+        Vec2 d = position(j) - p;
+        float along = d.x * dir.x + d.y * dir.y;
+        float across = std::abs(d.x * dir.y - d.y * dir.x);
+        // cars in the exact same spot: the older one leads
+        bool ahead = along > 0.0f || (along == 0.0f && j < i);
+        if(!ahead || along > LOOKAHEAD || across >= CAR_SIZE) {
+            return;
+        }
+        allowed = std::min(allowed, std::max(0.0f, along - CAR_SIZE - MIN_GAP));
+    });
+    return allowed;
+}
+
+// Whether a car put at `p` would stay clear of every car in the grid.
+template <typename Position>
+bool isFree(const SpatialHash& grid, Position position, const Vec2& p) {
+    bool free = true;
+    grid.forEachInRect({p.x - CAR_SIZE, p.y - CAR_SIZE, 2 * CAR_SIZE, 2 * CAR_SIZE}, [&](uint32_t j) {
+        Vec2 d = position(j) - p;
+        if(std::abs(d.x) < CAR_SIZE && std::abs(d.y) < CAR_SIZE) {
+            free = false;
+        }
+    });
+    return free;
+}
+
+// Fixed rectangles (e.g. intersections) put into a dense grid over their
+// bounding box, every cell listing the rectangles that overlap it. Built once;
+// finding the rectangle at a point looks at one cell, which mostly lists
+// nothing or a single rectangle.
+class RectIndex {
+public:
+    void build(const std::vector<Rect>& rects, float cellSize) {
+        this->rects = rects;
+        this->cellSize = cellSize;
+        cols = rows = 0;
+        if(rects.empty()) {
+            return;
+        }
+
+        float right = rects[0].left + rects[0].width, bottom = rects[0].top + rects[0].height;
+        origin = {rects[0].left, rects[0].top};
+        for(auto& rect: rects) {
+            origin.x = std::min(origin.x, rect.left);
+            origin.y = std::min(origin.y, rect.top);
+            right = std::max(right, rect.left + rect.width);
+            bottom = std::max(bottom, rect.top + rect.height);
+        }
+        cols = int32_t((right - origin.x) / cellSize) + 1;
+        rows = int32_t((bottom - origin.y) / cellSize) + 1;
+
+        // same counting sort as SpatialHash, a rectangle goes into every
+        // cell it touches
+        cellStart.assign(size_t(cols) * rows + 1, 0);
+        forEachCell([&](uint32_t cell, uint32_t) { ++cellStart[cell + 1]; });
+        for(size_t c = 0; c + 1 < cellStart.size(); ++c) {
+            cellStart[c + 1] += cellStart[c];
+        }
+        entries.resize(cellStart.back());
+        std::vector<uint32_t> fill(cellStart.begin(), cellStart.end() - 1);
+        forEachCell([&](uint32_t cell, uint32_t r) { entries[fill[cell]++] = r; });
+    }
+
+    // Box around all the rectangles, nothing outside of it has to be looked up.
+    Rect bounds() const {
+        return {origin.x, origin.y, cols * cellSize, rows * cellSize};
+    }
+
+    // Calls f(index) once for every rectangle overlapping `rect`.
+    template <typename F>
+    void forEachInRect(const Rect& rect, F f) const {
+        int32_t x0 = std::max(0, cellX(rect.left)), x1 = std::min(cols - 1, cellX(rect.left + rect.width));
+        int32_t y0 = std::max(0, cellY(rect.top)), y1 = std::min(rows - 1, cellY(rect.top + rect.height));
+        for(int32_t cy = y0; cy <= y1; ++cy) {
+            for(int32_t cx = x0; cx <= x1; ++cx) {
+                uint32_t cell = cy * cols + cx;
+                for(uint32_t e = cellStart[cell]; e < cellStart[cell + 1]; ++e) {
+                    const Rect& r = rects[entries[e]];
+                    bool overlaps = r.left < rect.left + rect.width && rect.left < r.left + r.width
+                        && r.top < rect.top + rect.height && rect.top < r.top + r.height;
+                    // a rectangle is in every cell it touches, only the first
+                    // one of them inside the query reports it
+                    if(overlaps && cx == std::max(x0, cellX(r.left)) && cy == std::max(y0, cellY(r.top))) {
+                        f(entries[e]);
+                    }
+                }
+            }
+        }
+    }
+
+    // Index of the rectangle containing `p`, -1 if there's none.
+    int32_t find(const Vec2& p) const {
+        int32_t cx = cellX(p.x);
+        int32_t cy = cellY(p.y);
+        if(cx < 0 || cy < 0 || cx >= cols || cy >= rows) {
+            return -1;
+        }
+        uint32_t cell = cy * cols + cx;
+        for(uint32_t e = cellStart[cell]; e < cellStart[cell + 1]; ++e) {
+            if(rects[entries[e]].contains(p)) {
+                return entries[e];
+            }
+        }
+        return -1;
+    }
+
+private:
+    std::vector<Rect> rects;
+    float cellSize = 1.0f;
+    Vec2 origin;
+    int32_t cols = 0, rows = 0;
+    std::vector<uint32_t> cellStart;
+    std::vector<uint32_t> entries;
+
+    int32_t cellX(float x) const {
+        return int32_t(std::floor((x - origin.x) / cellSize));
+    }
+
+    int32_t cellY(float y) const {
+        return int32_t(std::floor((y - origin.y) / cellSize));
+    }
+
+    template <typename F>
+    void forEachCell(F f) const {
+        for(uint32_t r = 0; r < rects.size(); ++r) {
+            const Rect& rect = rects[r];
+            int32_t x0 = int32_t((rect.left - origin.x) / cellSize);
+            int32_t y0 = int32_t((rect.top - origin.y) / cellSize);
+            int32_t x1 = std::min(cols - 1, int32_t((rect.left + rect.width - origin.x) / cellSize));
+            int32_t y1 = std::min(rows - 1, int32_t((rect.top + rect.height - origin.y) / cellSize));
+            for(int32_t cy = y0; cy <= y1; ++cy) {
+                for(int32_t cx = x0; cx <= x1; ++cx) {
+                    f(uint32_t(cy * cols + cx), r);
+                }
+            }
+        }
+    }
+};
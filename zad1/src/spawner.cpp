@@ -0,0 +1,289 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "clock.cpp"
+#include "network.cpp"
+
+enum ArrivalKind {
+    ARRIVAL_POISSON,
+    ARRIVAL_FIXED,
+    ARRIVAL_BURST
+};
+
+// Cars coming in on one loop or road of the network.
+struct SpawnStream {
+    bool onRoad;
+    uint16_t route;
+    ArrivalKind kind;
+    // cars per second, bursts per second for ARRIVAL_BURST
+    double rate;
+    uint32_t burstSize = 1;
+    // cars spawned on this stream in total
+    uint64_t limit = std::numeric_limits<uint64_t>::max();
+};
+
+// What cars come in where, read from a config file (see spawns.txt) or made
+// to look like the old spawners. Lines are:
+//
+//   cap <cars>                               at most this many cars alive
+//   <loop|road> <index|*> poisson <cars/s> [max <cars>]
+//   <loop|road> <index|*> fixed <cars/s> [max <cars>]
+//   <loop|road> <index|*> burst <cars> <bursts/s> [max <cars>]
+//
+// A * gives every loop or road a stream of its own, each with its own max.
+// Anything after a # is a comment.
+struct SpawnPlan {
+    static const size_t DEFAULT_MAX_ALIVE = 10000;
+
+    std::vector<SpawnStream> streams;
+    size_t maxAlive = DEFAULT_MAX_ALIVE;
+
+    // NUM_CARS cars on the loops and cars on the roads until the end, about
+    // one every 550 ms of each, like the spawners this replaces.
+    static SpawnPlan standard(const RoadNetwork& network) {
+        const double RATE = 1000.0 / 550.0;
+        SpawnPlan plan;
+        size_t loops = network.loops.size();
+        for(uint16_t loop = 0; loop < loops; ++loop) {
+            uint64_t limit = NUM_CARS / loops + (loop < NUM_CARS % loops);
+            if(limit) {
+                plan.streams.push_back({false, loop, ARRIVAL_POISSON, RATE / loops, 1, limit});
+            }
+        }
+        for(uint16_t road = 0; road < network.roads.size(); ++road) {
+            plan.streams.push_back({true, road, ARRIVAL_POISSON, RATE / network.roads.size()});
+        }
+        return plan;
+    }
+
+    // Replaces this plan with the one in the file. Prints what's wrong and
+    // returns false if the file can't be read or names a loop or road
+    // `network` doesn't have.
+    bool load(const std::string& path, const RoadNetwork& network) {
+        std::ifstream in(path);
+        if(!in) {
+            std::cerr << "can't open " << path << "\n";
+            return false;
+        }
+
+        SpawnPlan plan;
+        std::string line;
+        for(int lineNumber = 1; std::getline(in, line); ++lineNumber) {
+            std::istringstream words(line.substr(0, line.find('#')));
+            std::string keyword;
+            if(!(words >> keyword)) {
+                continue;
+            }
+
+            bool ok = true;
+            if(keyword == "cap") {
+                ok = bool(words >> plan.maxAlive);
+            } else if(keyword == "loop" || keyword == "road") {
+                SpawnStream stream{keyword == "road", 0, ARRIVAL_POISSON, 0.0};
+                size_t count = stream.onRoad ? network.roads.size() : network.loops.size();
+                std::string route, kind, option;
+                ok = bool(words >> route >> kind);
+                if(ok && kind == "poisson") {
+                    ok = bool(words >> stream.rate);
+                } else if(ok && kind == "fixed") {
+                    stream.kind = ARRIVAL_FIXED;
+                    ok = bool(words >> stream.rate);
+                } else if(ok && kind == "burst") {
+                    stream.kind = ARRIVAL_BURST;
+                    ok = bool(words >> stream.burstSize >> stream.rate);
+                } else {
+                    ok = false;
+                }
+                if(ok && words >> option) {
+                    ok = option == "max" && words >> stream.limit;
+                }
+                ok = ok && stream.rate >= 0.0;
+
+                size_t first = 0, last = count;
+                if(ok && route != "*") {
+                    ok = bool(std::istringstream(route) >> first);
+                    last = first + 1;
+                    if(ok && first >= count) {
+                        std::cerr << path << ":" << lineNumber << ": no " << keyword << " " << first << "\n";
+                        return false;
+                    }
+                }
+                for(size_t i = first; ok && i < last; ++i) {
+                    stream.route = i;
+                    plan.streams.push_back(stream);
+                }
+            } else {
+                std::cerr << path << ":" << lineNumber << ": unknown keyword " << keyword << "\n";
+                return false;
+            }
+            if(!ok) {
+                std::cerr << path << ":" << lineNumber << ": bad " << keyword << " line\n";
+                return false;
+            }
+        }
+
+        *this = std::move(plan);
+        return true;
+    }
+};
+
+// Cars that came in at a spawn point and wait there for their spot to
+// clear. A spawn point is a CAR_SIZE square: two cars that come in within the
+// same one always overlap, so they could only join one after the other
+// anyway. A point holds at most CAPACITY cars, more arrivals at a full point
+// are turned away, and only the car at its front is checked, so a jammed
+// point costs one check a tick however long it has been jammed.
+class SpawnQueues {
+public:
+    static const size_t CAPACITY = 8;
+
+    // Returns false if the car's spawn point was full and it was turned away.
+    bool push(const Car& car) {
+        auto& point = points[pointOf(car)];
+        if(point.size() >= CAPACITY) {
+            ++turnedAwayCars;
+            return false;
+        }
+        point.push_back(car);
+        ++queued;
+        return true;
+    }
+
+    size_t size() const {
+        return queued;
+    }
+
+    uint64_t turnedAway() const {
+        return turnedAwayCars;
+    }
+
+    // Offers the front car of every point to `tryJoin(car)`, which returns
+    // whether it took it; then the next one is offered. The points go in a
+    // fixed order, so the same cars join in the same order on a replay.
+    template <typename F>
+    void admit(F tryJoin) {
+        for(auto point = points.begin(); point != points.end();) {
+            auto& cars = point->second;
+            while(!cars.empty() && tryJoin(cars.front())) {
+                cars.pop_front();
+                --queued;
+            }
+            point = cars.empty() ? points.erase(point) : std::next(point);
+        }
+    }
+
+private:
+    std::map<uint64_t, std::deque<Car>> points;
+    size_t queued = 0;
+    uint64_t turnedAwayCars = 0;
+
+    static uint64_t pointOf(const Car& car) {
+        auto x = uint32_t(int32_t(std::floor(car.position.x / CAR_SIZE)));
+        auto y = uint32_t(int32_t(std::floor(car.position.y / CAR_SIZE)));
+        return uint64_t(x) << 32 | y;
+    }
+};
+
+// Draws the cars of a SpawnPlan tick by tick: every call to spawnDue hands
+// out all the cars arriving on one tick at once, however many that is, so a
+// high rate costs a few more cars per tick instead of a sleep per car.
+//
+// Arrivals that would take the number of live cars over the plan's cap are
+// turned away and counted in throttled(), the streams don't make up for
+// them later; the ones that do arrive can still be turned away by a full
+// spawn point (see SpawnQueues). Everything depends only on the seed and the
+// ticks asked for.
+class Spawner {
+public:
+    Spawner(const RoadNetwork& network, const SpawnPlan& plan, uint32_t seed)
+        : network(network), maxAlive(plan.maxAlive), gen(seed) {
+        for(auto& config: plan.streams) {
+            double perTick = config.rate > 0.0 ? config.rate / SimClock::TICKS_PER_SECOND : 1.0;
+            streams.push_back({config, std::poisson_distribution<uint32_t>(perTick)});
+        }
+    }
+
+    uint64_t spawned() const {
+        return spawnedCars;
+    }
+
+    uint64_t throttled() const {
+        return throttledCars;
+    }
+
+    // Appends the cars arriving on the next tick to `batch`. `alive` is how
+    // many cars are on the road before this call, not counting the ones still
+    // waiting at a spawn point.
+    void spawnDue(uint64_t alive, std::vector<Car>& batch) {
+        for(auto& stream: streams) {
+            uint64_t due = std::min<uint64_t>(arrivals(stream), stream.config.limit - stream.spawned);
+            uint64_t room = maxAlive > alive ? maxAlive - alive : 0;
+            if(due > room) {
+                throttledCars += due - room;
+                due = room;
+            }
+            for(uint64_t i = 0; i < due; ++i) {
+                batch.push_back(spawn(stream.config));
+            }
+            stream.spawned += due;
+            spawnedCars += due;
+            alive += due;
+        }
+    }
+
+private:
+    struct Stream {
+        SpawnStream config;
+        std::poisson_distribution<uint32_t> poisson;
+        // fraction of a car (or a burst) that arrived on earlier ticks
+        double credit = 0.0;
+        uint64_t spawned = 0;
+    };
+
+    const RoadNetwork& network;
+    size_t maxAlive;
+    std::mt19937 gen;
+    std::vector<Stream> streams;
+    std::uniform_int_distribution<int> car_offset_dist{int(-network.thickness / 4), int(network.thickness / 4)};
+    std::uniform_real_distribution<float> speed_dist{CAR_SPEED_MIN, CAR_SPEED_MAX};
+
+    uint64_t spawnedCars = 0;
+    uint64_t throttledCars = 0;
+
+    uint64_t arrivals(Stream& stream) {
+        const SpawnStream& config = stream.config;
+        if(stream.spawned >= config.limit || config.rate <= 0.0) {
+            return 0;
+        }
+        if(config.kind == ARRIVAL_POISSON) {
+            return stream.poisson(gen);
+        }
+        stream.credit += config.rate / SimClock::TICKS_PER_SECOND;
+        uint64_t whole = stream.credit;
+        stream.credit -= whole;
+        return config.kind == ARRIVAL_BURST ? whole * config.burstSize : whole;
+    }
+
+    Car spawn(const SpawnStream& config) {
+        float x = car_offset_dist(gen);
+        float y = car_offset_dist(gen);
+        float speed = speed_dist(gen);
+        if(config.onRoad) {
+            return Car::spawnCross(network.roadStart(config.route), {x, y}, speed, config.route);
+        }
+        return Car::spawnTrack(network.loopStart(config.route), {x, y}, speed, config.route);
+    }
+};
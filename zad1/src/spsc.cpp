@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <new>
+
+// Bounded single producer, single consumer queue. The producer only writes
+// `tail`, the consumer only writes `head`, so neither ever waits for the
+// other: a full queue makes tryPush fail, an empty one makes tryPop fail.
+// Each side keeps a copy of the other's index and only reloads it when the
+// copy says the queue is full/empty.
+template <typename T>
+class SpscQueue {
+public:
+    SpscQueue(size_t capacity)
+        : capacity(std::bit_ceil(capacity)), mask(this->capacity - 1),
+          slots(std::make_unique<Slot[]>(this->capacity)) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    ~SpscQueue() {
+        for(size_t h = head; h != tail; ++h) {
+            item(h)->~T();
+        }
+    }
+
+    // Only for the producer.
+    bool tryPush(const T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if(t - headCache == capacity) {
+            headCache = head.load(std::memory_order_acquire);
+            if(t - headCache == capacity) {
+                return false;
+            }
+        }
+        new(&slots[t & mask].storage) T(item);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Only for the consumer.
+    bool tryPop(T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if(h == tailCache) {
+            tailCache = tail.load(std::memory_order_acquire);
+            if(h == tailCache) {
+                return false;
+            }
+        }
+        T* slot = this->item(h);
+        item = *slot;
+        slot->~T();
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    struct Slot {
+        alignas(T) std::byte storage[sizeof(T)];
+    };
+
+    const size_t capacity;
+    const size_t mask;
+    std::unique_ptr<Slot[]> slots;
+
+    // consumer side, then producer side, on separate cache lines
+    alignas(64) std::atomic<size_t> head = 0;
+    size_t tailCache = 0;
+    alignas(64) std::atomic<size_t> tail = 0;
+    size_t headCache = 0;
+
+    T* item(size_t index) {
+        return std::launder(reinterpret_cast<T*>(&slots[index & mask].storage));
+    }
+};
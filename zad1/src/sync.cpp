@@ -0,0 +1,304 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "admission.cpp"
+#include "car.cpp"
+#include "eventlog.cpp"
+#include "telemetry.cpp"
+#include "trace.cpp"
+
+// Told when a queued car gets its token, for cars that can't sleep on a flag
+// because they don't have a thread of their own (see CarExecutor). Called
+// with the region's mutex held, so it shouldn't do more than schedule the car.
+struct GrantListener {
+    virtual void granted() = 0;
+};
+
+// Ids of the cars inside a region, for the overlay. Only changed under the
+// region's mutex, but read without it: `version` is odd while a change is
+// being made, so a reader copies the ids and keeps the copy if the version
+// was even and the same before and after. Nothing allocates, and the token
+// path only does a few atomic stores.
+template <int N>
+class Occupancy {
+public:
+    static const uint32_t EMPTY = UINT32_MAX;
+
+    Occupancy() {
+        for(auto& id: ids) {
+            id.store(EMPTY, std::memory_order_relaxed);
+        }
+    }
+
+    // Only with the region's mutex held.
+    void add(uint32_t id) {
+        for(int i = 0; i < N; ++i) {
+            if(ids[i].load(std::memory_order_relaxed) == EMPTY) {
+                change([&] { ids[i].store(id, std::memory_order_relaxed); });
+                return;
+            }
+        }
+    }
+
+    // Only with the region's mutex held. The others keep their order.
+    void remove(uint32_t id) {
+        for(int i = 0; i < N; ++i) {
+            if(ids[i].load(std::memory_order_relaxed) == id) {
+                change([&] {
+                    for(int j = i; j + 1 < N; ++j) {
+                        ids[j].store(ids[j + 1].load(std::memory_order_relaxed), std::memory_order_relaxed);
+                    }
+                    ids[N - 1].store(EMPTY, std::memory_order_relaxed);
+                });
+                return;
+            }
+        }
+    }
+
+    uint32_t version() const {
+        return currentVersion.load(std::memory_order_acquire);
+    }
+
+    // Copies the ids, in the order the cars got in, EMPTY after the last
+    // one. Returns the version they are of, or nullopt if they changed while
+    // reading; try again next frame.
+    std::optional<uint32_t> read(uint32_t (&out)[N]) const {
+        uint32_t before = currentVersion.load(std::memory_order_acquire);
+        if(before % 2) {
+            return std::nullopt;
+        }
+        for(int i = 0; i < N; ++i) {
+            out[i] = ids[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(currentVersion.load(std::memory_order_relaxed) != before) {
+            return std::nullopt;
+        }
+        return before;
+    }
+
+private:
+    std::atomic<uint32_t> currentVersion = 0;
+    std::atomic<uint32_t> ids[N];
+
+    template <typename F>
+    void change(F f) {
+        uint32_t v = currentVersion.load(std::memory_order_relaxed);
+        currentVersion.store(v + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        f();
+        currentVersion.store(v + 2, std::memory_order_release);
+    }
+};
+
+// Hands out at most MAX_TOKENS tokens for one sync region:
+// - every request gets a ticket and waits in the queue of its direction
+// - the policy picks which queue the next car comes from (see admission.cpp),
+//   by default the head with the lowest ticket, but a car only gets in if it
+//   goes the same way as the cars inside (or the region is empty)
+// Every waiting car sleeps on its own flag, so a release only wakes the cars
+// it actually lets in.
+class SyncSystem {
+public:
+    static const int MAX_TOKENS = 4;
+    std::mutex mutex;
+    std::atomic<bool> exit;
+    // Bumped on every release, the only event that can let a queued car in.
+    std::atomic<uint32_t> releases = 0;
+
+    SyncStats stats;
+
+    // Grants and releases go here when set, tagged with regionId.
+    EventLog* events = nullptr;
+    uint16_t regionId = 0;
+
+    // who's inside, for the overlay
+    Occupancy<MAX_TOKENS> occupancy;
+
+    // Only while nobody is waiting, e.g. before the first car comes.
+    void setPolicy(std::unique_ptr<AdmissionPolicy> newPolicy) {
+        std::unique_lock lock(mutex);
+        policy = std::move(newPolicy);
+    }
+
+    // Blocks until the car is let in.
+    bool requestToken(const Car& car) {
+        std::unique_lock lock(mutex);
+        if(exit) {
+            return true;
+        }
+        Waiter& waiter = enqueue(car);
+        lock.unlock();
+
+        // only this car releases its waiter, so it stays alive while we sleep
+        if(!waiter.granted) {
+            TraceSpan span("requestToken wait", "region", regionId);
+            waiter.granted.wait(false);
+        }
+        return true;
+    }
+
+    // Non-blocking variant for when the car shares its thread with others:
+    // the car keeps its place in the queue and asks again on the next update.
+    bool tryRequestToken(const Car& car) {
+        std::unique_lock lock(mutex);
+        bool queued = waiters.count(car.id);
+        bool granted = enqueue(car).granted || exit;
+        if(queued && !granted) {
+            stats.spuriousWakeups.fetch_add(1, std::memory_order_relaxed);
+        }
+        return granted;
+    }
+
+    // Has `listener` told when the car, queued by tryRequestToken, gets its
+    // token. Returns false if there's nothing to wait for: the car already got
+    // it or isn't queued.
+    bool notifyOnGrant(const Car& car, GrantListener* listener) {
+        std::unique_lock lock(mutex);
+        auto pos = waiters.find(car.id);
+        if(pos == waiters.end() || pos->second.granted || exit) {
+            return false;
+        }
+        pos->second.listener = listener;
+        return true;
+    }
+
+    bool releaseToken(const Car& car) {
+        std::unique_lock lock(mutex);
+        auto pos = waiters.find(car.id);
+        if(pos == waiters.end()) {
+            return false;
+        }
+
+        Waiter& waiter = pos->second;
+        if(waiter.holding) {
+            --holders;
+            stats.holdNs.record(sinceNs(waiter.grantedAt));
+            if(events) {
+                events->record(EVENT_RELEASE, car.id, regionId);
+            }
+            occupancy.remove(car.id);
+        } else {
+            auto& queue = queues[waiter.state];
+            queue.erase(std::find(queue.begin(), queue.end(), &waiter));
+            --waiting;
+        }
+        waiters.erase(pos);
+        ++releases;
+
+        grantWaiting();
+        return true;
+    }
+
+    // Lets every waiting car go, and every later request pass immediately.
+    void shutdown() {
+        std::unique_lock lock(mutex);
+        exit = true;
+        for(auto& [id, waiter]: waiters) {
+            waiter.granted = true;
+            waiter.granted.notify_one();
+        }
+    }
+
+private:
+    struct Waiter {
+        uint32_t id;
+        CarMoveState state;
+        uint64_t ticket;
+        // grants before this car asked
+        uint64_t grantsBefore;
+        bool holding = false;
+        std::atomic<bool> granted = false;
+        GrantListener* listener = nullptr;
+        chrono::steady_clock::time_point requestedAt = chrono::steady_clock::now();
+        chrono::steady_clock::time_point grantedAt;
+
+        Waiter(uint32_t id, CarMoveState state, uint64_t ticket, uint64_t grantsBefore)
+            : id(id), state(state), ticket(ticket), grantsBefore(grantsBefore) {}
+    };
+
+    // unordered_map never moves its elements, so the queues can point into it
+    std::unordered_map<uint32_t, Waiter> waiters;
+    std::deque<Waiter*> queues[NUM_MOVE_STATES];
+    uint64_t nextTicket = 0;
+    uint64_t grantCount = 0;
+    int holders = 0;
+    size_t waiting = 0;
+    CarMoveState holderState;
+    std::optional<CarMoveState> lastGrantedState;
+    std::unique_ptr<AdmissionPolicy> policy = std::make_unique<FifoPolicy>();
+
+    static uint64_t sinceNs(chrono::steady_clock::time_point start) {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    }
+
+    Waiter& enqueue(const Car& car) {
+        auto [pos, inserted] = waiters.try_emplace(car.id, car.id, car.state, nextTicket, grantCount);
+        if(inserted) {
+            stats.requests.fetch_add(1, std::memory_order_relaxed);
+            stats.queueDepth.record(waiting);
+            ++nextTicket;
+            ++waiting;
+            queues[car.state].push_back(&pos->second);
+            grantWaiting();
+        }
+        return pos->second;
+    }
+
+    // Lets in as many cars from the front of the queues as the policy and
+    // the rules allow.
+    void grantWaiting() {
+        while(holders < MAX_TOKENS && waiting > 0) {
+            RegionState region;
+            region.holders = holders;
+            region.holderState = holderState;
+            for(int state = 0; state < NUM_MOVE_STATES; ++state) {
+                auto& queue = queues[state];
+                if(!queue.empty()) {
+                    region.queues[state] = {queue.size(), queue.front()->ticket, grantCount - queue.front()->grantsBefore};
+                }
+            }
+
+            std::optional<CarMoveState> state = policy->next(region);
+            if(!state || queues[*state].empty() || (holders > 0 && *state != holderState)) {
+                break;
+            }
+            Waiter* waiter = queues[*state].front();
+            queues[*state].pop_front();
+            --waiting;
+            ++holders;
+            ++grantCount;
+            policy->granted(waiter->state);
+            holderState = waiter->state;
+            waiter->holding = true;
+            waiter->grantedAt = chrono::steady_clock::now();
+            occupancy.add(waiter->id);
+
+            stats.grants.fetch_add(1, std::memory_order_relaxed);
+            stats.waitNs.record(chrono::duration_cast<chrono::nanoseconds>(waiter->grantedAt - waiter->requestedAt).count());
+            if(lastGrantedState && *lastGrantedState != waiter->state) {
+                stats.directionSwitches.fetch_add(1, std::memory_order_relaxed);
+            }
+            lastGrantedState = waiter->state;
+            if(events) {
+                events->record(EVENT_GRANT, waiter->id, regionId);
+            }
+
+            waiter->granted = true;
+            waiter->granted.notify_one();
+            if(waiter->listener) {
+                std::exchange(waiter->listener, nullptr)->granted();
+            }
+        }
+    }
+};
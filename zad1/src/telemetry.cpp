@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Histogram with power of two buckets: bucket i counts values in
+// [2^(i-1), 2^i), bucket 0 counts zeros. Recording is a few relaxed atomic
+// adds, so it can be done from any thread without locking; readers may see
+// a slightly torn picture while recording goes on, which is fine for stats.
+struct Histogram {
+    static const int BUCKETS = 48;
+
+    std::atomic<uint64_t> buckets[BUCKETS] = {};
+    std::atomic<uint64_t> count = 0;
+    std::atomic<uint64_t> sum = 0;
+    std::atomic<uint64_t> max = 0;
+
+    void record(uint64_t value) {
+        int bucket = std::min<int>(std::bit_width(value), BUCKETS - 1);
+        buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+
+        uint64_t previous = max.load(std::memory_order_relaxed);
+        while(value > previous && !max.compare_exchange_weak(previous, value, std::memory_order_relaxed)) {}
+    }
+
+    double mean() const {
+        uint64_t n = count.load(std::memory_order_relaxed);
+        return n ? double(sum.load(std::memory_order_relaxed)) / n : 0.0;
+    }
+
+    // Upper bound of the bucket holding the p-th value (p in [0, 1]), but no
+    // more than the largest value seen.
+    uint64_t percentile(double p) const {
+        uint64_t n = count.load(std::memory_order_relaxed);
+        uint64_t rank = p * n;
+        uint64_t seen = 0;
+        for(int i = 0; i < BUCKETS; ++i) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if(seen > rank) {
+                uint64_t upper = i == 0 ? 0 : uint64_t(1) << i;
+                return std::min(upper, max.load(std::memory_order_relaxed));
+            }
+        }
+        return max.load(std::memory_order_relaxed);
+    }
+
+    void writeJson(std::ostream& out) const {
+        out << "{\"count\":" << count.load(std::memory_order_relaxed)
+            << ",\"mean\":" << mean()
+            << ",\"p50\":" << percentile(0.5)
+            << ",\"p90\":" << percentile(0.9)
+            << ",\"p99\":" << percentile(0.99)
+            << ",\"max\":" << max.load(std::memory_order_relaxed)
+            << ",\"buckets\":[";
+        for(int i = 0; i < BUCKETS; ++i) {
+            out << (i ? "," : "") << buckets[i].load(std::memory_order_relaxed);
+        }
+        out << "]}";
+    }
+
+    void writeCsv(std::ostream& out, const std::string& region, const std::string& metric) const {
+        out << region << ',' << metric << ',' << count.load(std::memory_order_relaxed) << ',' << mean()
+            << ',' << percentile(0.5) << ',' << percentile(0.9) << ',' << percentile(0.99)
+            << ',' << max.load(std::memory_order_relaxed) << '\n';
+    }
+};
+
+// What a sync region records about the cars going through it.
+struct SyncStats {
+    // from asking for a token until getting it, and from getting it until
+    // giving it back
+    Histogram waitNs;
+    Histogram holdNs;
+    // cars already waiting when a new one queues up
+    Histogram queueDepth;
+
+    std::atomic<uint64_t> requests = 0;
+    std::atomic<uint64_t> grants = 0;
+    // grants going another way than the previous one
+    std::atomic<uint64_t> directionSwitches = 0;
+    // a car asked again after being woken up, but still couldn't get in
+    std::atomic<uint64_t> spuriousWakeups = 0;
+
+    static void writeCsvHeader(std::ostream& out) {
+        out << "region,metric,count,mean,p50,p90,p99,max\n";
+    }
+
+    void writeJson(std::ostream& out) const {
+        out << "{\"requests\":" << requests.load(std::memory_order_relaxed)
+            << ",\"grants\":" << grants.load(std::memory_order_relaxed)
+            << ",\"direction_switches\":" << directionSwitches.load(std::memory_order_relaxed)
+            << ",\"spurious_wakeups\":" << spuriousWakeups.load(std::memory_order_relaxed)
+            << ",\"wait_ns\":";
+        waitNs.writeJson(out);
+        out << ",\"hold_ns\":";
+        holdNs.writeJson(out);
+        out << ",\"queue_depth\":";
+        queueDepth.writeJson(out);
+        out << "}";
+    }
+
+    // Counters go in the count column, with the rest left empty.
+    void writeCsv(std::ostream& out, const std::string& region) const {
+        out << region << ",requests," << requests.load(std::memory_order_relaxed) << ",,,,,\n";
+        out << region << ",grants," << grants.load(std::memory_order_relaxed) << ",,,,,\n";
+        out << region << ",direction_switches," << directionSwitches.load(std::memory_order_relaxed) << ",,,,,\n";
+        out << region << ",spurious_wakeups," << spuriousWakeups.load(std::memory_order_relaxed) << ",,,,,\n";
+        waitNs.writeCsv(out, region, "wait_ns");
+        holdNs.writeCsv(out, region, "hold_ns");
+        queueDepth.writeCsv(out, region, "queue_depth");
+    }
+};
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace chrono = std::chrono;
+
+// Timeline of what every thread was doing, written as Chrome trace-event
+// JSON (open it in chrome://tracing or ui.perfetto.dev). Code marks spans
+// with TraceSpan; while tracing is off that's one relaxed load.
+//
+// Every thread records into its own list of chunks, so recording never
+// locks: the thread fills its newest chunk and publishes how far it got with
+// a release store, and links a new chunk when it's full. A writer can read
+// all of them while the threads keep going. Chunks are only freed at exit,
+// at most MAX_SPANS spans are kept over the whole run and the rest are
+// counted as dropped.
+//
+// A thread only gets a buffer the first time it records, and hands it back
+// when it exits; the next new thread carries on in it, under a tid of its
+// own. So with a thread per car there are only as many buffers as cars
+// running at the same time, and a thread that never records costs nothing.
+//
+// Span names and arg names have to be string literals, only the pointer is
+// kept.
+class Tracer {
+public:
+    static const size_t CHUNK_SPANS = 256;
+    static const size_t MAX_SPANS = 1 << 22;
+
+    static Tracer& get() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    bool enabled() const {
+        return on.load(std::memory_order_relaxed);
+    }
+
+    // Spans that start from now on are recorded, until stop().
+    void start() {
+        captureStart = sinceEpoch();
+        captureEnd = UINT64_MAX;
+        on.store(true, std::memory_order_relaxed);
+    }
+
+    void stop() {
+        on.store(false, std::memory_order_relaxed);
+        captureEnd = sinceEpoch();
+    }
+
+    // How this thread shows up in the trace.
+    void nameThread(const char* name) {
+        Registration& self = registration();
+        self.name = name;
+        if(self.tidName) {
+            self.tidName->store(name, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t now() const {
+        return sinceEpoch();
+    }
+
+    void record(const char* name, uint64_t start, uint64_t end, const char* argName = nullptr, uint64_t arg = 0) {
+        if(used.fetch_add(1, std::memory_order_relaxed) >= MAX_SPANS) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        ThreadBuffer& thread = buffer();
+        thread.push({name, argName, start, end - start, arg, thread.tid});
+    }
+
+    // Writes the spans of the last capture, of every thread that ever
+    // recorded, also the ones that are gone.
+    void write(const std::string& path) {
+        std::ofstream out(path);
+        out << std::fixed << std::setprecision(3);
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool first = true;
+        size_t written = 0;
+        std::unique_lock lock(buffersMutex);
+        for(size_t i = 0; i < tidNames.size(); ++i) {
+            out << (first ? "" : ",") << "\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << i + 1
+                << ",\"args\":{\"name\":\"" << tidNames[i].load(std::memory_order_relaxed) << "\"}}";
+            first = false;
+        }
+        for(auto& thread: buffers) {
+            thread->forEach([&](const Span& span) {
+                if(span.start < captureStart || span.start > captureEnd) {
+                    return;
+                }
+                out << ",\n{\"ph\":\"X\",\"name\":\"" << span.name << "\",\"pid\":1,\"tid\":" << span.tid
+                    << ",\"ts\":" << span.start / 1000.0 << ",\"dur\":" << span.duration / 1000.0;
+                if(span.argName) {
+                    out << ",\"args\":{\"" << span.argName << "\":" << span.arg << "}";
+                }
+                out << "}";
+                ++written;
+            });
+        }
+        out << "\n]}\n";
+        std::cout << "trace written to " << path << " (" << written << " spans, "
+            << dropped.load() << " dropped)\n";
+    }
+
+private:
+    struct Span {
+        const char* name;
+        const char* argName;
+        uint64_t start;
+        uint64_t duration;
+        uint64_t arg;
+        uint32_t tid;
+    };
+
+    struct Chunk {
+        Span spans[CHUNK_SPANS];
+        std::atomic<uint32_t> count = 0;
+        std::atomic<Chunk*> next = nullptr;
+    };
+
+    // Only the thread it's lent to writes to it. Made under buffersMutex, so
+    // `head` is there before write() can see the buffer.
+    struct ThreadBuffer {
+        // of the thread it's lent to, every span keeps the one it was
+        // recorded by
+        uint32_t tid = 0;
+        std::unique_ptr<Chunk> head = std::make_unique<Chunk>();
+        Chunk* tail = head.get();
+        std::vector<std::unique_ptr<Chunk>> rest;
+
+        void push(const Span& span) {
+            uint32_t n = tail->count.load(std::memory_order_relaxed);
+            if(n == CHUNK_SPANS) {
+                Chunk* chunk = rest.emplace_back(std::make_unique<Chunk>()).get();
+                tail->next.store(chunk, std::memory_order_release);
+                tail = chunk;
+                n = 0;
+            }
+            tail->spans[n] = span;
+            tail->count.store(n + 1, std::memory_order_release);
+        }
+
+        // Safe while the thread is recording, it sees what was published.
+        template <typename F>
+        void forEach(F f) const {
+            for(const Chunk* chunk = head.get(); chunk; chunk = chunk->next.load(std::memory_order_acquire)) {
+                uint32_t n = chunk->count.load(std::memory_order_acquire);
+                for(uint32_t i = 0; i < n; ++i) {
+                    f(chunk->spans[i]);
+                }
+            }
+        }
+    };
+
+    chrono::steady_clock::time_point epoch = chrono::steady_clock::now();
+    std::atomic<bool> on = false;
+    std::atomic<uint64_t> captureStart = 0;
+    std::atomic<uint64_t> captureEnd = UINT64_MAX;
+    std::atomic<size_t> used = 0;
+    std::atomic<uint64_t> dropped = 0;
+
+    // only taken the first time a thread records, when it exits and by
+    // write()
+    std::mutex buffersMutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    // of threads that exited
+    std::vector<ThreadBuffer*> unused;
+    // the name of tid i + 1; a deque, so a thread can keep a pointer to its
+    // own while others are added
+    std::deque<std::atomic<const char*>> tidNames;
+
+    struct Registration {
+        ThreadBuffer* buffer = nullptr;
+        std::atomic<const char*>* tidName = nullptr;
+        const char* name = "thread";
+
+        ~Registration() {
+            if(buffer) {
+                Tracer& tracer = Tracer::get();
+                std::unique_lock lock(tracer.buffersMutex);
+                tracer.unused.push_back(buffer);
+            }
+        }
+    };
+
+    static Registration& registration() {
+        thread_local Registration self;
+        return self;
+    }
+
+    uint64_t sinceEpoch() const {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - epoch).count();
+    }
+
+    // Only called while recording.
+    ThreadBuffer& buffer() {
+        Registration& self = registration();
+        if(!self.buffer) {
+            std::unique_lock lock(buffersMutex);
+            if(unused.empty()) {
+                self.buffer = buffers.emplace_back(std::make_unique<ThreadBuffer>()).get();
+            } else {
+                self.buffer = unused.back();
+                unused.pop_back();
+            }
+            self.tidName = &tidNames.emplace_back(self.name);
+            self.buffer->tid = tidNames.size();
+        }
+        return *self.buffer;
+    }
+};
+
+// Records the time from its construction to its destruction (or end()) as
+// a span, if tracing was on when it started.
+class TraceSpan {
+public:
+    TraceSpan(const char* name, const char* argName = nullptr, uint64_t arg = 0)
+        : name(name), argName(argName), arg(arg) {
+        Tracer& tracer = Tracer::get();
+        if(tracer.enabled()) {
+            start = tracer.now();
+            active = true;
+        }
+    }
+
+    ~TraceSpan() {
+        end();
+    }
+
+    void end() {
+        if(active) {
+            Tracer& tracer = Tracer::get();
+            tracer.record(name, start, tracer.now(), argName, arg);
+            active = false;
+        }
+    }
+
+private:
+    const char* name;
+    const char* argName;
+    uint64_t arg;
+    uint64_t start = 0;
+    bool active = false;
+};
+
+// Locks `mutex` until destroyed, tracing the wait for it as `waitName` and
+// the time it's held as `holdName`.
+class TracedLock {
+public:
+    TracedLock(std::mutex& mutex, const char* waitName, const char* holdName): mutex(mutex), holdName(holdName) {
+        Tracer& tracer = Tracer::get();
+        traced = tracer.enabled();
+        uint64_t waitStart = traced ? tracer.now() : 0;
+        mutex.lock();
+        if(traced) {
+            lockedAt = tracer.now();
+            tracer.record(waitName, waitStart, lockedAt);
+        }
+    }
+
+    ~TracedLock() {
+        if(traced) {
+            Tracer& tracer = Tracer::get();
+            tracer.record(holdName, lockedAt, tracer.now());
+        }
+        mutex.unlock();
+    }
+
+    TracedLock(const TracedLock&) = delete;
+    TracedLock& operator=(const TracedLock&) = delete;
+
+private:
+    std::mutex& mutex;
+    const char* holdName;
+    bool traced;
+    uint64_t lockedAt = 0;
+};
@@ -0,0 +1,384 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <SFML/Graphics.hpp>
+
+#include "cars.cpp"
+#include "snapshot.cpp"
+
+// Everything SFML lives here. The simulation only knows plain positions, the
+// view turns them into shapes when a frame is drawn.
+
+inline sf::Vector2f toSf(const Vec2& v) {
+    return {v.x, v.y};
+}
+
+inline sf::FloatRect toSf(const Rect& r) {
+    return {r.left, r.top, r.width, r.height};
+}
+
+// Pan and zoom over the world. The event thread moves it, the render thread
+// reads it once per frame, so it's behind a mutex.
+class Camera {
+public:
+    static constexpr float MIN_SCALE = 0.01f;
+    static constexpr float MAX_SCALE = 8.0f;
+    // zoom factor of a wheel step, window pixels an arrow key pans by
+    static constexpr float ZOOM_STEP = 1.2f;
+    static constexpr float PAN_STEP = 100.0f;
+
+    Camera(const Vec2& worldSize, sf::Vector2u windowSize): worldSize(worldSize), windowSize(windowSize) {
+        fit();
+    }
+
+    // Shows the whole world.
+    void fit() {
+        std::unique_lock lock(mutex);
+        center = {worldSize.x / 2, worldSize.y / 2};
+        scale = std::min(windowSize.x / worldSize.x, windowSize.y / worldSize.y);
+    }
+
+    // By `delta` window pixels.
+    void pan(sf::Vector2f delta) {
+        std::unique_lock lock(mutex);
+        center += delta / scale;
+    }
+
+    // Zooms in by `factor` (out if it's below 1), keeping the point under
+    // `pixel` where it is.
+    void zoom(float factor, sf::Vector2i pixel) {
+        std::unique_lock lock(mutex);
+        sf::Vector2f offset = sf::Vector2f(pixel) - sf::Vector2f(windowSize) / 2.0f;
+        sf::Vector2f world = center + offset / scale;
+        scale = std::clamp(scale * factor, MIN_SCALE, MAX_SCALE);
+        center = world - offset / scale;
+    }
+
+    void resize(sf::Vector2u size) {
+        std::unique_lock lock(mutex);
+        windowSize = size;
+    }
+
+    sf::View view() const {
+        std::unique_lock lock(mutex);
+        return sf::View(toSf(visibleLocked()));
+    }
+
+    // The part of the world in the window.
+    Rect visible() const {
+        std::unique_lock lock(mutex);
+        return visibleLocked();
+    }
+
+    // Window pixels per world pixel.
+    float pixelScale() const {
+        std::unique_lock lock(mutex);
+        return scale;
+    }
+
+private:
+    mutable std::mutex mutex;
+    Vec2 worldSize;
+    sf::Vector2u windowSize;
+    sf::Vector2f center;
+    float scale = 1.0f;
+
+    Rect visibleLocked() const {
+        float width = windowSize.x / scale, height = windowSize.y / scale;
+        return {center.x - width / 2, center.y - height / 2, width, height};
+    }
+};
+
+// The camera controls of every window: R fits the world, the arrows pan, the
+// wheel zooms at the cursor and dragging with any but the left mouse button
+// pans. Returns whether `event` was one of them.
+inline bool handleCameraEvent(Camera& camera, const sf::Event& event, std::optional<sf::Vector2i>& dragFrom) {
+    if(event.type == sf::Event::KeyPressed) {
+        switch(event.key.code) {
+        case sf::Keyboard::R: camera.fit(); return true;
+        case sf::Keyboard::Left: camera.pan({-Camera::PAN_STEP, 0.0f}); return true;
+        case sf::Keyboard::Right: camera.pan({Camera::PAN_STEP, 0.0f}); return true;
+        case sf::Keyboard::Up: camera.pan({0.0f, -Camera::PAN_STEP}); return true;
+        case sf::Keyboard::Down: camera.pan({0.0f, Camera::PAN_STEP}); return true;
+        default: return false;
+        }
+    }
+    if(event.type == sf::Event::MouseWheelScrolled) {
+        auto& wheel = event.mouseWheelScroll;
+        camera.zoom(std::pow(Camera::ZOOM_STEP, wheel.delta), {wheel.x, wheel.y});
+        return true;
+    }
+    if(event.type == sf::Event::MouseButtonPressed && event.mouseButton.button != sf::Mouse::Left) {
+        dragFrom = sf::Vector2i(event.mouseButton.x, event.mouseButton.y);
+        return true;
+    }
+    if(event.type == sf::Event::MouseButtonReleased) {
+        dragFrom.reset();
+        return true;
+    }
+    if(event.type == sf::Event::MouseMoved && dragFrom) {
+        sf::Vector2i to(event.mouseMove.x, event.mouseMove.y);
+        camera.pan(sf::Vector2f(*dragFrom - to));
+        dragFrom = to;
+        return true;
+    }
+    if(event.type == sf::Event::Resized) {
+        camera.resize({event.size.width, event.size.height});
+        return true;
+    }
+    return false;
+}
+
+inline bool overlaps(const Rect& a, const Rect& b) {
+    return a.left < b.left + b.width && b.left < a.left + a.width
+        && a.top < b.top + b.height && b.top < a.top + a.height;
+}
+
+// Draws the cars with two draw calls, one for the bodies and one for the
+// ids. Ids are put together from digit quads pointing into the font texture;
+// the digits are rasterized once, when the view is created.
+//
+// How much is drawn depends on how big a car is on screen: bodies and ids,
+// only bodies once the ids can't be read, and once cars are smaller than
+// DOT_PIXELS a heatmap of how many there are in every HEATMAP_PIXELS square.
+struct CarView {
+    static const unsigned LABEL_SIZE = 12;
+    static constexpr float LABEL_PIXELS = 10.0f;
+    static constexpr float DOT_PIXELS = 2.0f;
+    static constexpr float HEATMAP_PIXELS = 8.0f;
+
+    const sf::Font& font;
+    sf::VertexArray bodies{sf::Triangles};
+    sf::VertexArray labels{sf::Triangles};
+
+    struct Digit {
+        sf::FloatRect bounds;
+        sf::FloatRect textureRect;
+        float advance;
+    };
+    Digit digits[10];
+
+    CarView(const sf::Font& font): font(font) {
+        for(int d = 0; d < 10; ++d) {
+            const sf::Glyph& glyph = font.getGlyph('0' + d, LABEL_SIZE, false);
+            digits[d] = {glyph.bounds, sf::FloatRect(glyph.textureRect), glyph.advance};
+        }
+    }
+
+    // `cars` are the ones in `visible`, `scale` is window pixels per world
+    // pixel.
+    void draw(sf::RenderWindow& window, const std::vector<CarSnapshot>& cars, const Rect& visible, float scale) {
+        bodies.clear();
+        labels.clear();
+
+        if(CAR_SIZE * scale < DOT_PIXELS) {
+            drawHeatmap(window, cars, visible, scale);
+            return;
+        }
+        bool withLabels = CAR_SIZE * scale >= LABEL_PIXELS;
+
+        for(auto& car: cars) {
+            auto topLeft = toSf(car.position) - sf::Vector2f{CAR_SIZE / 2, CAR_SIZE / 2};
+            appendQuad(bodies, {topLeft.x, topLeft.y, CAR_SIZE, CAR_SIZE}, {}, sf::Color::White);
+            if(!withLabels) {
+                continue;
+            }
+
+            // same layout as sf::Text: baseline LABEL_SIZE below the top
+            uint8_t idDigits[10];
+            int numDigits = 0;
+            uint32_t id = car.id;
+            do {
+                idDigits[numDigits++] = id % 10;
+                id /= 10;
+            } while(id);
+
+            float x = topLeft.x;
+            float baseline = topLeft.y + LABEL_SIZE;
+            while(numDigits--) {
+                const Digit& digit = digits[idDigits[numDigits]];
+                appendQuad(labels, {x + digit.bounds.left, baseline + digit.bounds.top, digit.bounds.width, digit.bounds.height},
+                    digit.textureRect, sf::Color::Black);
+                x += digit.advance;
+            }
+        }
+
+        window.draw(bodies);
+        window.draw(labels, &font.getTexture(LABEL_SIZE));
+    }
+
+private:
+    std::vector<uint32_t> density;
+
+    void drawHeatmap(sf::RenderWindow& window, const std::vector<CarSnapshot>& cars, const Rect& visible, float scale) {
+        float cell = HEATMAP_PIXELS / scale;
+        int cols = int(std::ceil(visible.width / cell)), rows = int(std::ceil(visible.height / cell));
+        density.assign(size_t(cols) * rows, 0);
+        uint32_t most = 0;
+        for(auto& car: cars) {
+            int cx = int((car.position.x - visible.left) / cell), cy = int((car.position.y - visible.top) / cell);
+            if(cx >= 0 && cy >= 0 && cx < cols && cy < rows) {
+                most = std::max(most, ++density[cy * cols + cx]);
+            }
+        }
+
+        for(int cy = 0; cy < rows; ++cy) {
+            for(int cx = 0; cx < cols; ++cx) {
+                uint32_t n = density[cy * cols + cx];
+                if(n) {
+                    // log scale, a single car still shows
+                    float heat = std::log1p(float(n)) / std::log1p(float(most));
+                    sf::Color color(255, uint8_t(255 * (1 - heat)), 0, uint8_t(96 + 159 * heat));
+                    appendQuad(bodies, {visible.left + cx * cell, visible.top + cy * cell, cell, cell}, {}, color);
+                }
+            }
+        }
+        window.draw(bodies);
+    }
+
+    static void appendQuad(sf::VertexArray& vertices, const sf::FloatRect& rect, const sf::FloatRect& textureRect, sf::Color color) {
+        sf::Vector2f topLeft{rect.left, rect.top};
+        sf::Vector2f topRight{rect.left + rect.width, rect.top};
+        sf::Vector2f bottomLeft{rect.left, rect.top + rect.height};
+        sf::Vector2f bottomRight{rect.left + rect.width, rect.top + rect.height};
+
+        sf::Vector2f texTopLeft{textureRect.left, textureRect.top};
+        sf::Vector2f texTopRight{textureRect.left + textureRect.width, textureRect.top};
+        sf::Vector2f texBottomLeft{textureRect.left, textureRect.top + textureRect.height};
+        sf::Vector2f texBottomRight{textureRect.left + textureRect.width, textureRect.top + textureRect.height};
+
+        vertices.append({topLeft, color, texTopLeft});
+        vertices.append({topRight, color, texTopRight});
+        vertices.append({bottomLeft, color, texBottomLeft});
+        vertices.append({bottomLeft, color, texBottomLeft});
+        vertices.append({topRight, color, texTopRight});
+        vertices.append({bottomRight, color, texBottomRight});
+    }
+};
+
+// Ids of the cars inside one sync region. The text is only made again when
+// the region's occupancy changed since the last frame.
+struct SyncSystemView {
+    sf::Text passingVehiclesText;
+    sf::RectangleShape passingVehiclesBackground;
+    // never a version a complete read returns, so the first frame formats
+    uint32_t shownVersion = 1;
+    std::string passingVehicles;
+
+    SyncSystemView(const sf::Font& font) {
+        passingVehiclesBackground.setSize({100.0, 40.0});
+        passingVehiclesBackground.setFillColor(sf::Color(255, 255, 255, 100));
+
+        passingVehiclesText.setCharacterSize(14);
+        passingVehiclesText.setFont(font);
+    }
+
+    void setTextPosition(const sf::Vector2f& position) {
+        passingVehiclesBackground.setPosition(position);
+        passingVehiclesText.setPosition(position);
+    }
+
+    void draw(sf::RenderWindow& window, const SyncSystem& syncSystem) {
+        auto& occupancy = syncSystem.occupancy;
+        uint32_t ids[SyncSystem::MAX_TOKENS];
+        std::optional<uint32_t> version;
+        if(occupancy.version() != shownVersion && (version = occupancy.read(ids))) {
+            passingVehicles.clear();
+            for(uint32_t id: ids) {
+                if(id != Occupancy<SyncSystem::MAX_TOKENS>::EMPTY) {
+                    passingVehicles += std::to_string(id);
+                    passingVehicles += ' ';
+                }
+            }
+            passingVehiclesText.setString(passingVehicles);
+            shownVersion = *version;
+        }
+        window.draw(passingVehiclesBackground);
+        window.draw(passingVehiclesText);
+    }
+};
+
+// The cars inside every intersection in view, left out when zoomed out too
+// far to read them.
+struct CarSystemView {
+    static constexpr float MIN_SCALE = 0.5f;
+
+    std::vector<SyncSystemView> regions;
+
+    CarSystemView(const CarSystem& carSystem, const sf::Font& font) {
+        for(auto& intersection: carSystem.network.intersections) {
+            auto& box = intersection.box;
+            regions.emplace_back(font).setTextPosition({box.left + box.width, box.top + box.height});
+        }
+    }
+
+    void draw(sf::RenderWindow& window, CarSystem& carSystem, const Rect& visible, float scale) {
+        if(scale < MIN_SCALE) {
+            return;
+        }
+        // the text hangs off the bottom right corner of its intersection
+        Rect area{visible.left - 100.0f, visible.top - 40.0f, visible.width + 100.0f, visible.height + 40.0f};
+        carSystem.network.forEachIntersectionIn(area, [&](uint32_t i) {
+            regions[i].draw(window, carSystem.regions[i]);
+        });
+    }
+};
+
+// The loops, roads and intersections, made into shapes once. Only the ones
+// in view are drawn.
+struct RoadNetworkView {
+    const RoadNetwork& network;
+    std::vector<sf::RectangleShape> loops;
+    std::vector<sf::RectangleShape> roads;
+    std::vector<sf::RectangleShape> intersections;
+    // what each loop and road covers, outline included
+    std::vector<Rect> loopBounds;
+    std::vector<Rect> roadBounds;
+
+    RoadNetworkView(const RoadNetwork& network): network(network) {
+        float t = network.thickness;
+        for(auto& loop: network.loops) {
+            // the outline is drawn outside the shape, so the road ends up
+            // centered on the path
+            auto& path = loop.path;
+            auto& shape = loops.emplace_back(sf::Vector2f{path.width - t, path.height - t});
+            shape.setPosition(path.left + t / 2, path.top + t / 2);
+            shape.setOutlineThickness(t);
+            shape.setOutlineColor(sf::Color::Blue);
+            shape.setFillColor(sf::Color::Transparent);
+            loopBounds.push_back({path.left - t / 2, path.top - t / 2, path.width + t, path.height + t});
+        }
+        for(auto& road: network.roads) {
+            auto& shape = roads.emplace_back(sf::Vector2f{road.width, network.size.y});
+            shape.setPosition(road.left, 0.0f);
+            shape.setFillColor(sf::Color::Blue);
+            roadBounds.push_back({road.left, 0.0f, road.width, network.size.y});
+        }
+        for(auto& intersection: network.intersections) {
+            auto& box = intersection.box;
+            auto& shape = intersections.emplace_back(sf::Vector2f{box.width, box.height});
+            shape.setPosition(box.left, box.top);
+            shape.setFillColor(sf::Color::Red);
+        }
+    }
+
+    void draw(sf::RenderWindow& window, const Rect& visible) {
+        for(size_t i = 0; i < loops.size(); ++i) {
+            if(overlaps(loopBounds[i], visible)) {
+                window.draw(loops[i]);
+            }
+        }
+        for(size_t i = 0; i < roads.size(); ++i) {
+            if(overlaps(roadBounds[i], visible)) {
+                window.draw(roads[i]);
+            }
+        }
+        network.forEachIntersectionIn(visible, [&](uint32_t i) {
+            window.draw(intersections[i]);
+        });
+    }
+};
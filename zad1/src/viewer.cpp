@@ -0,0 +1,96 @@
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <SFML/Graphics.hpp>
+
+#include "network.cpp"
+#include "shm.cpp"
+#include "view.cpp"
+
+// Watches a simulation running in another process, like a headless server
+// (see headless.cpp): maps its SnapshotRing and draws the newest snapshot in
+// the same way the window of main.cpp does, minus the sync region overlays.
+// Any number of viewers can watch one server, none of them slows it down.
+//
+// usage: viewer [/ring] [roads.txt]
+//
+// The roads file has to be the one the server runs, without it it's the
+// track from layout.cpp.
+
+const float FRAMETIME_INFO_PRINT_INTERVAL_MS = 1000.0f;
+
+int main(int argc, char** argv) {
+    std::string ringName = argc > 1 ? argv[1] : "/traffic";
+
+    RoadNetwork network = RoadNetwork::standard();
+    if(argc > 2 && *argv[2] && !network.load(argv[2])) {
+        return 1;
+    }
+
+    SnapshotRing ring;
+    if(!ring.open(ringName)) {
+        return 1;
+    }
+
+    sf::RenderWindow window(sf::VideoMode(WINDOW_WIDTH, WINDOW_HEIGHT), "Projekt Systemy operacyjne - zadanie 1: " + ringName);
+    window.setFramerateLimit(120);
+
+    sf::Font font;
+    font.loadFromFile("/usr/share/fonts/TTF/DejaVuSansMono.ttf");
+
+    RoadNetworkView networkView(network);
+    CarView carView(font);
+    Camera camera(network.size, window.getSize());
+
+    Snapshot received;
+    SnapshotInterpolator interpolator;
+    std::vector<CarSnapshot> frameCars;
+
+    std::optional<sf::Vector2i> dragFrom;
+
+    auto lastFrametimePrint = chrono::steady_clock::now();
+    uint32_t numFrame = 0;
+    uint32_t tornReads = 0;
+
+    while(window.isOpen()) {
+        sf::Event event;
+        while(window.pollEvent(event)) {
+            if(event.type == sf::Event::Closed) {
+                window.close();
+            }
+            handleCameraEvent(camera, event, dragFrom);
+        }
+        ++numFrame;
+
+        auto currentTime = chrono::steady_clock::now();
+        if(ring.read(received)) {
+            interpolator.update(received, currentTime);
+        } else {
+            ++tornReads;
+        }
+        Rect visible = camera.visible();
+        float scale = camera.pixelScale();
+        interpolator.at(currentTime, visible, frameCars);
+
+        window.clear();
+        window.setView(camera.view());
+        networkView.draw(window, visible);
+        carView.draw(window, frameCars, visible, scale);
+        window.display();
+
+        float frametimeFull = chrono::duration_cast<ms>(chrono::steady_clock::now() - currentTime).count();
+        if(chrono::duration_cast<ms>(currentTime - lastFrametimePrint).count() > FRAMETIME_INFO_PRINT_INTERVAL_MS) {
+            std::cout.precision(3);
+            std::cout << '[' << numFrame << ']' << "   ";
+            std::cout << "tick: " << received.tick << "   ";
+            std::cout << "cars: " << received.cars.size() << "   ";
+            std::cout << "missed reads: " << tornReads << "   ";
+            std::cout << "frame: " << std::fixed << std::setw(5) << frametimeFull << " ms   \n";
+
+            lastFrametimePrint = currentTime;
+        }
+    }
+
+    return 0;
+}